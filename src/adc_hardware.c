@@ -9,25 +9,69 @@
 // that is available at http://www.gnu.org/licenses/gpl.txt
 //
 // history:   2013-04-20 V0.1 Initial version
+//            2026-10-16 V0.2 Channels are stale after the DCC signal is lost
+//            2026-10-16 V0.3 Samples are taken by the ADC interrupt, independent of main
+//            2026-10-16 V0.4 Thresholds per input, and calibration of these thresholds
+//            2026-10-16 V0.5 The thresholds follow the baseline (drift) of each input
+//            2026-10-16 V0.6 Bit-sliced history: one byte per sample, one bit per input
+//            2026-10-16 V0.7 The masks are published together, with a generation counter
 // authors:   ap
 //
 // Calling:
 // - init_occupied_tracks() is called once from main during start up 
 // - detect_occupied_tracks is called from main as aften as possible
-//   detect_occupied_tracks uses internal logic that decides upon the best moment to perform the ADC
+//
+// Sampling runs without main:
+// - Every 2 ms the Timer 2 ISR (rs_bus_hardware.c) requests a conversion (new_adc_requested)
+// - The DCC ISR (dcc_receiver.c) starts it when J is high compared to K
+// - ISR(ADC_vect) sets or clears the bit of that input pin in adc_raw, and selects the next pin.
+//   After pin 7 the scan is complete, and adc_raw is added to the history (adc_hist)
+// A full scan of the eight inputs thus takes 8 * 2 ms = 16 ms, plus on average half a DCC bit per 
+// sample, whatever main is doing (LCD, RS_connect(), EEPROM writes). detect_occupied_tracks only
+// evaluates the history after a new scan.
 // 
 // Results:
-// Are made available via adc_result[8]
-// - is_on  == 1: Track is certainly occupied by train (spikes have already been filtered) 
-// - is_off == 1: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// Are made available as masks, bit i (mask 1 << i) is input pin i:
+// - adc_on:  Track is certainly occupied by train (spikes have already been filtered) 
+// - adc_off: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// - adc_stale: The DCC signal (track power) was lost and there is no new sample yet. Without
+//   track power the ADC is not started (see dcc_receiver.c) and a sample would say nothing anyway,
+//   so the input is neither in adc_on nor in adc_off, and the occupancy that was last reported stays.
+// Both masks are single bytes, written together at the end of detect_occupied_tracks (and by 
+// mark_tracks_stale). Since the consumers (occupancy.c, speed.c) also run from main, they always 
+// see a consistent pair. adc_generation is incremented whenever one of them changes, so consumers 
+// can see whether anything changed since they last looked.
 //
-// Intermediate information is stored in the local strcture called adc_port[8]
-// - adc_history: the last bit (thus mask 0x01) holds the current value for that input pin 
-//   0 => track is free / 1 => track is occupied
-// - on_is_stable == 1: if the last bit of adc_history is 1 that value can be used 
-// - delay_before_off == 0: if the last bit of adc_history is 0 that value can be used 
+// Intermediate information (bit-sliced, bit i is input pin i):
+// - adc_raw: the last sample; 0 => track is free / 1 => track is occupied. A sample between both
+//   thresholds leaves the bit as it is (hysteresis)
+// - adc_hist[0..7]: adc_raw of the last 8 scans, adc_hist[0] being the most recent one
+// Stability is decided for all inputs at once: the input is on if its bit is 1 in the last 
+// Min_Samples scans (AND), and its delay_before_off restarts if the bit is 1 in some of them, 
+// but not all (OR). That takes 2 * Min_Samples byte operations instead of a mask and compare per
+// input. Only the off delay is a counter per input, in adc_port[8]:
+// - delay_before_off == 0: if the bit of adc_hist[0] is 0 that value can be used 
 // - max_delay_before_off: copied from the CV variables
 //
+// Thresholds:
+// Each input has its own Threshold_On and Threshold_Off (CV125-CV140); if such CV is 0, the 
+// common value of CV35 / CV36 is used. Writing CV142 starts a calibration, which should be done
+// with all tracks empty (but with DCC). During CV142 seconds (0: 5 seconds) the samples of each
+// input are collected; afterwards the idle level (average) and the noise (highest sample minus 
+// the idle level) give:
+//   Threshold_Off = idle level + noise + CalMargin (CV141)
+//   Threshold_On  = Threshold_Off + CalMargin
+// These are used at once, and written in CV125-CV140, the idle level in CV143-CV150. The LED is on
+// during the calibration. An EEPROM write takes 8.5 ms, so the CVs are written one per 20 ms tick 
+// (save_calibration_tick), instead of blocking main for 24 writes.
+//
+// Drift:
+// Leakage (humidity, temperature) slowly changes the idle level of an input. Each input therefore
+// keeps a baseline: the average of its samples while the track is free (adc_off), over roughly 
+// 2^BASELINE_SHIFT samples (16 s). The thresholds move with the difference between the baseline
+// and the idle level of CV143-CV150, but at most DriftLimit (CV151) ADC steps. With DriftLimit = 0
+// the thresholds stay fixed; the baselines are still tracked, and can be read as diagnostic CVs.
+//
 //************************************************************************************************
 
 #include <stdlib.h>
@@ -42,52 +86,93 @@
 #include "myeeprom.h"           // wrapper for eeprom
 #include "dcc_receiver.h"	// hardware related DCC functions (layer 1 / physical layer)
 #include "rs_bus_hardware.h"	// hardware related RS-bus functions (layer 1 / physical layer)
+#include "led.h"		// LED on during the calibration
 // header file for this c file
-#include "adc_hardware.h"	// for the struct t_adc_result
+#include "adc_hardware.h"	// for the adc_on and adc_off masks
 
 
 //************************************************************************************************
 // Define global (=external) variables
 //************************************************************************************************
-t_adc_result adc_result[8];	// we have eight feedback signals
+unsigned char adc_on;		// Inputs that are certainly occupied
+unsigned char adc_off;		// Inputs that are certainly free
+unsigned char adc_stale;	// Inputs without a sample since the DCC signal was lost
+unsigned char adc_generation;	// Incremented whenever adc_on or adc_off changes (wraps around)
+unsigned int  adc_baseline[8];	// Idle level of the inputs, tracked while the track is free
 
 
 //************************************************************************************************
 // Define local variables
 struct {
-  unsigned int  adc_value;		// store all ADC values (only needed for debugging)
+  unsigned int  adc_value;		// last ADC value (for the calibration and the baseline)
   unsigned int  max_delay_before_off;	// integer (in steps of 10 msec). Initialised from CV(s)
   unsigned int  delay_before_off;	// integer (in steps of 10 msec). Current value
-  unsigned char adc_history;		// store 8 consequtive raw binary results, to later filter spikes
-  unsigned char on_is_stable;		// Filter spikes: check if a certain number of on samples are identical
 } adc_port[8];				// we have eight ADC input pins.
+volatile unsigned char adc_raw;		// Last sample of each input (1: occupied)
+volatile unsigned char adc_hist[8];	// adc_raw of the last 8 scans, to later filter spikes
+volatile unsigned char adc_scans;	// Number of completed scans (wraps around)
+unsigned char Scans_Done;		// adc_scans at the previous evaluation
+unsigned char New_On;			// adc_on, until it is published
+unsigned char New_Off;			// adc_off, until it is published
 
 // The following variables are initialised / derived from CV values 
 unsigned char ADC_Input_Pin;	// Keeps track which ADC input should be converter (between 0..7)
-unsigned char Threshold_On;	// If the ADC value is above this value, the track is occupied 
-unsigned char Threshold_Off;	// If the ADC value is below this value, the track is free 
-unsigned char Min_Samples_Mask; // Mask which we create from Min_Samples
+unsigned char Threshold_On[8];	// If the ADC value is above this value, the track is occupied 
+unsigned char Threshold_Off[8];	// If the ADC value is below this value, the track is free 
+unsigned char Base_On[8];	// Threshold_On without drift (CV125-CV132 or CV35)
+unsigned char Base_Off[8];	// Threshold_Off without drift (CV133-CV140 or CV36)
+unsigned char Idle_Level[8];	// Idle level the base thresholds belong to (CV143-CV150)
+unsigned char Drift_Limit;	// Max shift of the thresholds (CV151)
+unsigned char Min_Samples;	// Number of scans a value should be stable (1..8)
+volatile unsigned char DCC_Present;	// dcc_presence.present at the previous call of detect_occupied_tracks
+volatile unsigned char adc_new;	// Input pins with a new sample since the previous detect_occupied_tracks
+
+// Calibration of the thresholds
+#define CAL_DEFAULT_TIME  5		// Seconds, if CV142 is written with 0
+unsigned int Cal_Time;			// Remaining time (in steps of 10 msec). 0: no calibration
+struct {
+  unsigned long sum;			// sum of all samples
+  unsigned int  count;			// number of samples
+  unsigned int  max;			// highest sample
+} adc_cal[8];
+unsigned char Cal_Inputs;		// Inputs with a calibration result
+unsigned char Cal_Save;			// Calibration CVs still to be written (0..24)
+
+// Baseline tracking
+#define BASELINE_SHIFT   10		// The baseline averages over 2^BASELINE_SHIFT samples
+unsigned long Baseline_Sum[8];		// baseline << BASELINE_SHIFT
 
 
 //************************************************************************************************
 // set_multiplex_register of AVR hardware 
 //************************************************************************************************
 void set_multiplex_register(unsigned char pin_number) { 
-  // Rewrite the ADMUX, which controls the ADC multplexing
-  // Initialise first the ADC reference voltage
-  // Use Internal 2.56V Voltage Reference with external capacitor at AREF pin
-  ADMUX = (1 << REFS1) | (1 << REFS0);    // Note: we rewrite entire register
-  // Two most significant bits of result are in the ADCH, the remaining are in ADCL
-  ADMUX |= (0 << ADLAR);                  // Note: we do not rewrite, but set specific bit
-  // Initialise the multiplexer
-  if (pin_number == 0) {ADMUX |= (0 << MUX2) | (0 << MUX1) | (0 << MUX0); }
-  if (pin_number == 1) {ADMUX |= (0 << MUX2) | (0 << MUX1) | (1 << MUX0); }
-  if (pin_number == 2) {ADMUX |= (0 << MUX2) | (1 << MUX1) | (0 << MUX0); }
-  if (pin_number == 3) {ADMUX |= (0 << MUX2) | (1 << MUX1) | (1 << MUX0); }
-  if (pin_number == 4) {ADMUX |= (1 << MUX2) | (0 << MUX1) | (0 << MUX0); }
-  if (pin_number == 5) {ADMUX |= (1 << MUX2) | (0 << MUX1) | (1 << MUX0); }
-  if (pin_number == 6) {ADMUX |= (1 << MUX2) | (1 << MUX1) | (0 << MUX0); }
-  if (pin_number == 7) {ADMUX |= (1 << MUX2) | (1 << MUX1) | (1 << MUX0); }
+  // Rewrite the ADMUX, which controls the ADC multplexing. Since this is called from the ADC ISR,
+  // the entire register is written at once
+  // - Use Internal 2.56V Voltage Reference with external capacitor at AREF pin
+  // - Two most significant bits of result are in the ADCH, the remaining are in ADCL
+  // - MUX2..MUX0 select the (single ended) input pin
+  ADMUX = (1 << REFS1) | (1 << REFS0) | (0 << ADLAR) | (pin_number & 0x07);
+}
+
+
+//************************************************************************************************
+// set_thresholds moves the thresholds of an input with the drift of its baseline
+//************************************************************************************************
+void set_thresholds(unsigned char pin) { 
+  // The thresholds are single bytes, so the ADC ISR always sees a consistent value
+  int drift = (int) adc_baseline[pin] - Idle_Level[pin];
+  int value;
+  if (drift > Drift_Limit) drift = Drift_Limit;
+  if (drift < -Drift_Limit) drift = -Drift_Limit;
+  value = Base_On[pin] + drift;
+  if (value > 255) value = 255;
+  if (value < 10) value = 10;
+  Threshold_On[pin] = value;
+  value = Base_Off[pin] + drift;
+  if (value > 255) value = 255;
+  if (value < 5) value = 5;
+  Threshold_Off[pin] = value;
 }
 
 
@@ -95,7 +180,6 @@ void set_multiplex_register(unsigned char pin_number) {
 // init_occupied_tracks will be directly called from main externally
 //************************************************************************************************
 void init_occupied_tracks(void) { 
-  unsigned char Min_Samples;	// Minimum number of samples a positive value should be stable
   unsigned int i;               // for-loop counter
   // Step 1: Initialise ADC prescaler and the "ADMUX register"
   // With a X-tal of 11.0592 Mhz, and a preferred ADC clock frequency between 50-200Khz
@@ -107,22 +191,31 @@ void init_occupied_tracks(void) {
   ADCSRA |= (0 << ADATE); 
   // Enable the ADC
   ADCSRA |= (1 << ADEN); 
-  // Note that we still need to set the ADMUX register.
-  // This is done, however, in "set_multiplex_register".
-  // For that purpose, we use the ADC_Input_Pin variable, which is set here to zero
+  // Set the ADMUX register for the first input pin. After each conversion, the ADC ISR
+  // selects the next one
   ADC_Input_Pin = 0;
-  // STEP 2: Read the CVs that hold the Threshold values
-  Threshold_On  = my_eeprom_read_byte(&CV.Threshold_on);
-  Threshold_Off = my_eeprom_read_byte(&CV.Threshold_of);
-  if (Threshold_On < 10) Threshold_On = 10;
-  if (Threshold_Off < 5) Threshold_Off = 5;
+  set_multiplex_register(ADC_Input_Pin);
+  // Enable the ADC conversion complete interrupt
+  ADCSRA |= (1 << ADIE);
+  // STEP 2: Read the CVs that hold the Threshold values. CV125-CV140 specify per input; if 0,
+  // the common CV35 / CV36 is used
+  // The baselines start at the idle level of CV143-CV150, thus without drift
+  Drift_Limit = my_eeprom_read_byte(&CV.DriftLimit);
+  for (i = 0; i < 8; i++) {
+    Base_On[i]  = my_eeprom_read_byte(&CV.ThresholdOn[i]);
+    Base_Off[i] = my_eeprom_read_byte(&CV.ThresholdOff[i]);
+    if (Base_On[i] == 0)  Base_On[i]  = my_eeprom_read_byte(&CV.Threshold_on);
+    if (Base_Off[i] == 0) Base_Off[i] = my_eeprom_read_byte(&CV.Threshold_of);
+    Idle_Level[i] = my_eeprom_read_byte(&CV.IdleLevel[i]);
+    adc_baseline[i] = Idle_Level[i];
+    Baseline_Sum[i] = (unsigned long) Idle_Level[i] << BASELINE_SHIFT;
+    set_thresholds(i);
+  }
   // STEP 3: Read the minimum number of positive samples that need to be the same, before the signal
-  // is considered to be stable. Ensure validity and use this number to calculate a mask
+  // is considered to be stable. Ensure validity; it is the number of adc_hist bytes to consider
   Min_Samples  = my_eeprom_read_byte(&CV.Min_Samples);
   if (Min_Samples == 0) {Min_Samples = 1;}
   if (Min_Samples > 8 ) {Min_Samples = 8;}  
-  Min_Samples_Mask = 1;
-  for (i = 1; i < Min_Samples; i++) {Min_Samples_Mask = Min_Samples_Mask * 2 + 1;}
   // STEP 4: Read the delay related CVs. These are CV11-CV18 (Lenz) and CV34 (OpenDecoder GBM)
   // CV11-CV18 allow specification per input; CV34 specifies for all inputs together.
   // By default we use CV11-CV18, but when its value is 0 we use CV34 instead
@@ -143,6 +236,135 @@ void init_occupied_tracks(void) {
   // Timer variable incremented each ms in rs_bus_hardware
   T_Sample = 0;			// The interval (in ms) between successive AD conversions
   T_DelayOff = 0;		// The delay (in ms) before an OFF message is considered stable
+  DCC_Present = 1;
+  Cal_Time = 0;
+  Cal_Save = 0;
+  New_On = 0;
+  New_Off = 0;
+}
+
+
+//************************************************************************************************
+// Calibration of the thresholds. start_calibration is called after CV142 is written
+//************************************************************************************************
+void start_calibration(unsigned char seconds) { 
+  unsigned char i;
+  if (seconds == 0) seconds = CAL_DEFAULT_TIME;
+  for (i = 0; i < 8; i++) {
+    adc_cal[i].sum = 0;
+    adc_cal[i].count = 0;
+    adc_cal[i].max = 0;
+  }
+  Cal_Time = seconds * 100;
+  turn_led_on();
+}
+
+
+void finish_calibration(void) { 
+  // Inputs without samples (no DCC signal during the calibration) keep their thresholds
+  unsigned char margin = my_eeprom_read_byte(&CV.CalMargin);
+  unsigned int level;			// idle level: average of the samples
+  unsigned int noise;			// highest sample above the idle level
+  unsigned int value;
+  unsigned char i;
+  Cal_Inputs = 0;
+  for (i = 0; i < 8; i++) {
+    if (adc_cal[i].count == 0) continue;
+    Cal_Inputs |= (1 << i);
+    level = adc_cal[i].sum / adc_cal[i].count;
+    noise = adc_cal[i].max - level;
+    value = level + noise + margin;
+    if (value > 254) value = 254;
+    if (value < 5) value = 5;
+    Base_Off[i] = value;
+    value = value + margin;
+    if (value > 255) value = 255;
+    if (value < 10) value = 10;
+    Base_On[i] = value;
+    // The measured level is the new reference for the drift
+    if (level > 255) level = 255;
+    Idle_Level[i] = level;
+    adc_baseline[i] = level;
+    Baseline_Sum[i] = (unsigned long) level << BASELINE_SHIFT;
+    set_thresholds(i);
+  }
+  Cal_Save = 24;			// CV125-CV140 and CV143-CV150, see save_calibration_tick
+  turn_led_off();
+}
+
+
+void save_calibration_tick(void) {
+  // Called from main every 20 ms. Writes the next CV of the calibration result; the previous
+  // EEPROM write has finished by then, so this does not wait
+  unsigned char i;
+  while (Cal_Save) {
+    Cal_Save --;
+    i = Cal_Save & 0x07;		// input
+    if (!(Cal_Inputs & (1 << i))) continue;
+    if (Cal_Save >= 16)     my_eeprom_write_byte(&CV.IdleLevel[i], Idle_Level[i]);
+    else if (Cal_Save >= 8) my_eeprom_write_byte(&CV.ThresholdOn[i], Base_On[i]);
+    else                    my_eeprom_write_byte(&CV.ThresholdOff[i], Base_Off[i]);
+    return;
+  }
+}
+
+
+//************************************************************************************************
+// mark_tracks_stale is called once the DCC signal is lost
+//************************************************************************************************
+void mark_tracks_stale(void) {
+  // Forget the history of all inputs: after the signal is back, a channel is on after Min_Samples
+  // new scans, and off after the full delay_before_off. Called with interrupts disabled
+  unsigned char i;
+  adc_raw = 0;
+  for (i = 0; i < 8; i++) {
+    adc_hist[i] = 0;
+    adc_port[i].delay_before_off = adc_port[i].max_delay_before_off;
+  }
+  New_On = 0;
+  New_Off = 0;
+  adc_stale = 0xFF;
+  if (adc_on || adc_off) {
+    adc_on = 0;
+    adc_off = 0;
+    adc_generation++;
+  }
+}
+
+
+//************************************************************************************************
+// ADC conversion complete
+//************************************************************************************************
+ISR(ADC_vect) {
+  // The conversion was started by the DCC ISR, after a request of the Timer 2 ISR
+  unsigned char pin = ADC_Input_Pin;
+  unsigned char mask = (1 << pin);
+  unsigned int adc_value = ADCW;	// ADCL and ADCH, in the right order
+  // Select the next pin right away; the next conversion is not started before the next request
+  ADC_Input_Pin = (pin + 1) & 7;
+  set_multiplex_register(ADC_Input_Pin);
+  // Convert the value into a binary value: the bit of this pin in adc_raw.
+  // Note that the case in which Threshold_off is erroneously made higher than Threshold_on
+  // the code still works, although Threshold_off will be ignored.
+  // If adc_value is between both Thresholds, the bit stays the same. Without the DCC signal 
+  // (see mark_tracks_stale), the value says nothing and is ignored
+  adc_port[pin].adc_value = adc_value;	// store value for the calibration
+  if (!DCC_Present) return;
+  adc_new |= mask;
+  if (adc_value > Threshold_On[pin]) adc_raw |= mask;
+  else if (adc_value < Threshold_Off[pin]) adc_raw &= ~mask;
+  // After the last pin, shift the history one scan and add adc_raw
+  if (pin == 7) {
+    adc_hist[7] = adc_hist[6];
+    adc_hist[6] = adc_hist[5];
+    adc_hist[5] = adc_hist[4];
+    adc_hist[4] = adc_hist[3];
+    adc_hist[3] = adc_hist[2];
+    adc_hist[2] = adc_hist[1];
+    adc_hist[1] = adc_hist[0];
+    adc_hist[0] = adc_raw;
+    adc_scans++;
+  }
 }
 
 
@@ -150,79 +372,93 @@ void init_occupied_tracks(void) {
 // detect_occupied_tracks is directly called from main externally, as frequent as possible
 //************************************************************************************************
 void detect_occupied_tracks(void) { 
-  // We want to have at least 1 msec between successive runs of the AD converter.
-  // For that purpose the counter T_Sample is incremented every 1 ms by the Timer 2 ISR
-  // (see rs_bus_hardware.c). 
-  // We check whether T_Sample >= 2 (instead of >=1) since the Timer 2 is running independently
-  // (within an ISR) and may therefore immediately fire after we set T_Sample = 0.
-  // All eight inputs will on average be read in 8 * 1,5 = 12 ms
-  unsigned int adc_value;
-  unsigned int relevant_samples;
-  unsigned char occupied;
-  unsigned char on_stable;
+  // The samples are taken by the ADC ISR (see above). Here we only evaluate adc_hist after a new 
+  // scan, and use the values of the input pins that have new samples
+  unsigned char all_on;		// inputs with 1 in the last Min_Samples scans
+  unsigned char any_on;		// inputs with 1 in at least one of the last Min_Samples scans
+  unsigned char zero_delay;	// inputs with delay_before_off == 0
+  unsigned char new_samples;
+  unsigned char mask;
   unsigned char i;
-  // STEP 1: Check whether Timer 2 has fired twice since previous invocation and the ADC is ready
-  // If yes, read the value from the ADC input pin and initialise reading of the following pin
-  if ((T_Sample >= 2) && ((ADCSRA & 0x40) == 0))
-  { // STEP 1A: Read ADC value
-    adc_value = ADCL + (ADCH * 256);                // Note: ADCL MUST be read before ADCH
-    adc_port[ADC_Input_Pin].adc_value = adc_value;  // store value for debugging purposes
-    // STEP 1B: convert integer into binary value, and add to "adc_history" (= set of bits).
-    // Note that the case in which Threshold_off is erroneously made higher than Threshold_on
-    // the code still works, although Threshold_off will be ignored.
-    // If adc_value is between both Thresholds, we ignore its value
-    if (adc_value > Threshold_On)
-    { // Shift all bits in the adc_history one to the left, the bit at the right becomes 0 
-      adc_port[ADC_Input_Pin].adc_history = (adc_port[ADC_Input_Pin].adc_history << 1);
-      // Add 1 to the right of adc_history (set bit 1)
-      adc_port[ADC_Input_Pin].adc_history |= 0x01;
+  // STEP 0: Check whether the DCC signal was lost since the previous call
+  if (dcc_presence.present != DCC_Present) {
+    cli();
+    DCC_Present = dcc_presence.present;
+    if (!DCC_Present) mark_tracks_stale();
+    sei();
+  }
+  // STEP 1: Take the set of input pins with new samples
+  if (adc_new == 0) new_samples = 0;
+  else {
+    cli();
+    new_samples = adc_new;
+    adc_new = 0;
+    sei();
+  }
+  adc_stale &= ~new_samples;
+  for (i = 0; i < 8; i++) {
+    if (!(new_samples & (1 << i))) continue;
+    // STEP 1A: during the calibration, collect the sample. The ISR writes adc_value of this pin
+    // again only after a full scan (16 ms)
+    if (Cal_Time) {
+      adc_cal[i].sum += adc_port[i].adc_value;
+      adc_cal[i].count ++;
+      if (adc_port[i].adc_value > adc_cal[i].max) adc_cal[i].max = adc_port[i].adc_value;
+    }
+    // STEP 1B: if the track is certainly free, the sample is added to the baseline (unless it is 
+    // above Threshold_On: the first sample of a train, or a spike)
+    else if ((New_Off & (1 << i)) && (adc_port[i].adc_value <= Threshold_On[i])) {
+      Baseline_Sum[i] = Baseline_Sum[i] - (Baseline_Sum[i] >> BASELINE_SHIFT) + adc_port[i].adc_value;
+      adc_baseline[i] = Baseline_Sum[i] >> BASELINE_SHIFT;
+      set_thresholds(i);
+    }
+  }
+  // STEP 1C: after a new scan, analyse adc_hist to see whether the "track on" signal is stable.
+  // If all Min_Samples scans are 1, "on" is stable; if all are 0, "off" is stable. 
+  // If they differ, reinitialise the delay_before_off
+  if (adc_scans != Scans_Done) {
+    all_on = 0xFF;
+    any_on = 0;
+    cli();				// the ISR may shift adc_hist
+    Scans_Done = adc_scans;
+    for (i = 0; i < Min_Samples; i++) {
+      all_on &= adc_hist[i];
+      any_on |= adc_hist[i];
     }
-    else if (adc_value < Threshold_Off)
-    { // Same as above. We do not have to clear the bit at the right, since the shift made it 0
-      adc_port[ADC_Input_Pin].adc_history = (adc_port[ADC_Input_Pin].adc_history << 1);
+    sei();
+    any_on &= ~all_on;			// the inputs that differ
+    if (any_on) {
+      for (i = 0, mask = 1; i < 8; i++, mask <<= 1)
+        if (any_on & mask) adc_port[i].delay_before_off = adc_port[i].max_delay_before_off;
     }
-    // STEP 1C: analyse adc_history to see whether the "track on" signal is stable
-    // Use a mask to select the number of samples that should be considered
-    // If the masked value is the same as the mask itself, all samples are 1, thus  "on" is stable
-    // If the masked value is 0, all samples are 0, thus  "off" is stable
-    // In that case reinitialise the delay_before_off
-    relevant_samples = adc_port[ADC_Input_Pin].adc_history & Min_Samples_Mask; // bitwise AND (mask)
-    if (relevant_samples == Min_Samples_Mask) {adc_port[ADC_Input_Pin].on_is_stable = 1;}
-    else 
-      if (relevant_samples == 0) {adc_port[ADC_Input_Pin].on_is_stable = 0;}
-      else
-      { adc_port[ADC_Input_Pin].on_is_stable = 0;
-        adc_port[ADC_Input_Pin].delay_before_off = adc_port[ADC_Input_Pin].max_delay_before_off;
-      }
-    // STEP 1D: Create the conclusion whether the ADC input pin is definitely ON
-    // use for readability two temporary veriables
-    occupied  = adc_port[ADC_Input_Pin].adc_history & 0x01;
-    on_stable = adc_port[ADC_Input_Pin].on_is_stable;
-    if ((occupied != 0) && (on_stable != 0)) adc_result[ADC_Input_Pin].is_on = 1;
-    else adc_result[ADC_Input_Pin].is_on = 0;   
-    // STEP 1F: initialise next AD conversion
-    ADC_Input_Pin = (ADC_Input_Pin + 1) % 8;        // next pin, modulo 8
-    set_multiplex_register(ADC_Input_Pin);
-    new_adc_requested = 1;
-    T_Sample = 0; // Reset 1 ms interval timer
+    // STEP 1D: The input pins that are definitely ON
+    New_On = all_on;
   }
   // STEP 2: Once every 10 msec we should decrease all "delay_before_off" values
   // and determine whether the ADC input pin is definitely OFF 
   // For that purpose the Timer 2 routine also maintains the T_DelayOff variable 
   if (T_DelayOff >= 10) { 
     T_DelayOff = 0;  // Reset
-    for (i = 0; i < 8; i++) {
-      // initialise the result to 0
-      adc_result[i].is_off = 0;
+    if (Cal_Time) {
+      Cal_Time --;
+      if (Cal_Time == 0) finish_calibration();
+    }
+    zero_delay = 0;
+    for (i = 0, mask = 1; i < 8; i++, mask <<= 1) {
+      if (adc_stale & mask) continue;	// keep the full delay until there is a new sample
       // STEP 2A: Decrease the delay_before_off value
       if (adc_port[i].delay_before_off > 0) {
         adc_port[i].delay_before_off --;}
-      // STEP 2B: Check if "is_off" may now be used
-      if (adc_port[i].delay_before_off == 0) {
-        occupied = adc_port[i].adc_history & 0x01;
-        if (occupied == 0) adc_result[i].is_off = 1;
-      }
+      if (adc_port[i].delay_before_off == 0) zero_delay |= mask;
     }
+    // STEP 2B: The input pins that are definitely OFF: delay passed, and free in the last scan
+    New_Off = zero_delay & ~adc_hist[0];
+  }
+  // STEP 3: Publish both masks at once
+  if ((New_On != adc_on) || (New_Off != adc_off)) {
+    adc_on = New_On;
+    adc_off = New_Off;
+    adc_generation++;
   }
 }
 
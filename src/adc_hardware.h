@@ -12,6 +12,10 @@
 // that is available at http://www.gnu.org/licenses/gpl.txt
 //
 // history:   2013-04-20 V0.1 Initial version
+//            2026-10-16 V0.2 Calibration of the thresholds
+//            2026-10-16 V0.3 Baseline drift tracking
+//            2026-10-16 V0.4 Results as masks (adc_on, adc_off, adc_stale)
+//            2026-10-16 V0.5 Generation counter (adc_generation)
 // authors:   ap
 //
 // Calling:
@@ -20,19 +24,22 @@
 //   detect_occupied_tracks uses internal logic that decides upon the best moment to perform the ADC
 // 
 // Results:
-// Are made available via adc_result[8]
-// - is_on  == 1: Track is certainly occupied by train (spikes have already been filtered) 
-// - is_off == 1: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// Are made available as masks; bit i (1 << i) is ADC input pin i
+// - adc_on:  Track is certainly occupied by train (spikes have already been filtered) 
+// - adc_off: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// - adc_stale: No sample since the DCC signal was lost (neither on nor off)
+// adc_on and adc_off are updated together; adc_generation changes whenever one of them changes
 //
 //--------------------------------------------------------------------------------------------
 void init_occupied_tracks(void);
 void detect_occupied_tracks(void);
+void start_calibration(unsigned char seconds);	// CV142 was written; tracks should be empty
+void save_calibration_tick(void);		// called from main every 20 ms
 
-typedef struct {			// we use temporary buffer to "pre-process" the adc_port values	
-  unsigned char is_on;			// the adc pin is high and stable
-  unsigned char is_off;			// the adc pin is low for longer a period (>= delay off time)
-} t_adc_result;
-
-extern t_adc_result adc_result[8];	// we have eight feedback signals
+extern unsigned char adc_on;		// the adc pin is high and stable
+extern unsigned char adc_off;		// the adc pin is low for longer a period (>= delay off time)
+extern unsigned char adc_stale;		// no sample since the DCC signal was lost
+extern unsigned char adc_generation;	// incremented whenever adc_on or adc_off changes
+extern unsigned int  adc_baseline[8];	// idle level of the input, tracked while the track is free
 
 #endif
@@ -19,6 +19,8 @@
 //            2007-05-07 V0.03 kw added Servo Repeat
 //            2007-08-06 V0.04 changed to CV-struct
 //            2010-09-14 V0.05 added reverser
+//            2026-10-16 V0.06 SRAM copy of the CV record (CV_RAM)
+//            2026-10-16 V0.07 the SRAM copy ends before the calibration CVs (CV_RAM_SIZE)
 //
 //------------------------------------------------------------------------
 //
@@ -99,3 +101,21 @@ volatile unsigned char Communicate = 0; // Communicationregister (for semaphors)
       {
         #include "cv_data_gbm.h"
       };
+
+
+//-----------------------------------------------------------------------------
+// SRAM copy of the CV record. Loaded by my_eeprom_load_cv() at startup, and kept
+// equal to the EEPROM by my_eeprom_write_byte(). The ATmega8535 has only 512 bytes
+// of SRAM, which is shared with the DCC ring buffer, the repeat cache, the ADC 
+// administration and the stack; the CV copy may use at most CV_RAM_BUDGET bytes.
+// The CVs from CV125 on are in EEPROM only (see CV_RAM_SIZE in cv_define.h).
+
+    unsigned char cv_ram[CV_RAM_SIZE];
+
+#if (SRAM_SIZE <= 512)
+  #define CV_RAM_BUDGET   160
+#else
+  #define CV_RAM_BUDGET   256
+#endif
+    // compile time check: the array size is negative if the CV record is too large
+    typedef char cv_ram_budget_exceeded[(CV_RAM_SIZE <= CV_RAM_BUDGET) ? 1 : -1];
@@ -57,6 +57,23 @@
 //                 Note: port and pins are NOT compatible with other decoder 2 hardware
 //
 
+//------------------------------------------------------------------------
+// 1.b) Configuration of Software Modules
+//
+// DCC receiver (see dcc_receiver.c):
+// DCC_RX_SAMPLING:     a rising edge on INT1 starts Timer0, the Timer0 overflow
+//                      ISR samples the DCC input 77us later (original OpenDecoder)
+// DCC_RX_EDGE_CAPTURE: INT1 fires on both edges, each edge is timestamped with
+//                      Timer1 and the half-bit widths are classified. Not recommended
+//                      on the OpenDecoder 2.2 PCB: no input capture (ICP1 is the
+//                      program button), and more cycles per bit
+#define DCC_RX_SAMPLING       0
+#define DCC_RX_EDGE_CAPTURE   1
+
+#ifndef DCC_RECEIVER_MODE                      // may be set on the command line
+#define DCC_RECEIVER_MODE     DCC_RX_SAMPLING
+#endif
+
 
 //========================================================================
 // 2. EEPROM Definitions (CV's)
@@ -64,10 +81,16 @@
 //
 // content is defined in config.c
 
+#include <stddef.h>
 #include "cv_define.h"
 
 extern t_cv_record CV EEMEM;
 
+// SRAM copy of CV, see myeeprom.c. Only the first CV_RAM_SIZE bytes exist: do not
+// use CV_RAM for the CVs from CV125 on
+extern unsigned char cv_ram[];
+#define CV_RAM (*(t_cv_record *) cv_ram)
+
 extern const t_cv_record CV_PRESET PROGMEM;
 
 
@@ -166,6 +189,12 @@ unsigned char semaphor_get(unsigned char flag)
 // The maximal possible delay is 262.14 ms / F_CPU in MHz.
 // This is 16ms for 16MHz; longest used delay: 1000us
 
+#if defined(HOST_BUILD)
+// Host (x86) builds, see host/replay.c: no busy waiting, and a restart ends the program
+#include <stdlib.h>
+static inline void _mydelay_us(double __us) { (void)__us; }
+static inline void _restart(void) { exit(0); }
+#else
 #ifndef _UTIL_DELAY_H_
   #include <util/delay.h>
 #endif
@@ -203,6 +232,7 @@ _restart(void)
        "icall" "\n\t"
      );
 }
+#endif
 
 
 #endif   // _config_h_
@@ -33,6 +33,15 @@
 //                               needs to be included multiple times!
 //                               It would be more logical to change the file extension to .ini, but
 //                               the Arduino IDE can only deal with .c, .cpp and .h files.
+//            2026-10-16 v0.8    Default value for RepeatWin
+//            2026-10-16 v0.9    Default value for ShortAddr (not used)
+//            2026-10-16 v0.A    Default values for FuncMap (no actions for F5..F28)
+//            2026-10-16 v0.B    Default values for AspectMap; Config is R/W
+//            2026-10-16 v0.C    Default values for the accessory address windows 2..4 (not used)
+//            2026-10-16 v0.D    Default values for SafeMode and SafePattern
+//            2026-10-16 v0.E    Default value for PowerFB (not used)
+//            2026-10-16 v0.F    Software version updated to 0x11: the CVs from RepeatWin on are
+//                               initialised at start up if the EEPROM is of version 0x10
 //
 //-----------------------------------------------------------------------------
 // NOTE: Don't include an #pragma once clause!!
@@ -49,7 +58,7 @@
    5,           // T_on_F2       4  R      Same dor relays 2
    5,           // T_on_F3       5  R      Same dor relays 3
    5,           // T_on_F4       6  R      Same dor relays 4
-   0x10,        // version       7  R      Software version. Should be > 7
+   0x11,        // version       7  R      Software version. Should be > 7
    0x0D,        // VID           8  R/W    Vendor ID (0x0D = DIY Decoder
                                           // write value 0x0D = 13 to reset CVs to default values
    0x80,        // myAddrH       9  R/W    Accessory Address high (3 bits)
@@ -71,14 +80,14 @@
    0,           // Search       23  R/W    If 1: decoder LED blinks
    0,           // cv536        24  R      not used
    0,           // Restart      25  R/W    To restart (as opposed to reset) the decoder: use after PoM write
-   0,           // DccQuality   26  R/W    DCC Signal Quality
+   0,           // DccQuality   26  R/W    DCC checksum errors (max. 255). Write: reset DCC statistics
    0b00110000,  // DecType      27  R/W    Decoder Type
 						// 0b00110000 - Track Occupancy decoder
 						// 0b00110001 - Track Occupancy decoder with reverser board
 						// 0b00110010 - Track Occupancy decoder with relays board
 						// 0b00110100 - Track Occupancy decoder with speed measurement
-   0,           // BiDi         28  R      Bi-Directional Communication Config. Keep at 0.
-                // Config       29  R      similar to CV#29; for acc. decoders
+   0,           // BiDi         28  R/W    Bi-Directional Communication Config. If not 0: measure RailCom cutout
+                // Config       29  R/W    similar to CV#29; for acc. decoders
       (1<<7)                                    // 1 = we are accessory
     | (0<<6)                                    // 0 = we do 9 bit decoder adressing
     | (0<<5)                                    // 0 = we are basic accessory decoder
@@ -119,3 +128,34 @@
    1,           // FB_S3        49  R/W    Feedback bit if Sensor 3 is active
    2,           // FB_S4        50  R/W    Feedback bit if Sensor 4 is active
    0,           // Polarization 51  R/W    If 0: J&K connected normal / if 1: J&K polarization changed
+
+// CVs used by the DCC decoder
+   50,          // RepeatWin    52  R/W    Window (in 20ms steps, 1..127) in which equal packets are repeats
+   0,           // ShortAddr    53  R/W    Short loco address (1..127) for PoM and F1..F4. 0: not used
+   {0, 0, 0, 0, // FuncMap      54  R/W    F5..F8:   Actions for F5 .. F28. 
+    0, 0, 0, 0, //              58  R/W    F9..F12:  0: none, 1..4: relays 1..4,
+    0, 0, 0, 0, //              62  R/W    F13..F16: 5: all relays (reverser), 6: LED search
+    0, 0, 0, 0, //              66  R/W    F17..F20  (6: LED blinks while the function is on, like CV23)
+    0, 0, 0, 0, //              70  R/W    F21..F24
+    0, 0, 0, 0},//              74  R/W    F25..F28
+   {0b01010101, // AspectMap    78  R/W    Aspect 0: all relays RED. Each CV is a RELAYS_PORT pattern
+    0b10101010, //              79  R/W    Aspect 1: all relays GREEN. Bits 2n (RED) and 2n+1 (GREEN)
+    0, 0, 0, 0, 0, 0, //        80  R/W    are the coils of relays n+1. A relays with none or both
+    0, 0, 0, 0, 0, 0, 0, 0, //  86  R/W    coils set is not changed
+    0, 0, 0, 0, 0, 0, 0, 0, //  94  R/W    
+    0, 0, 0, 0, 0, 0, 0, 0},// 102  R/W    Aspect 24..31
+   {{0, 0x80, 1, 4},       // Window 110  R/W    Window 2: AddrL, AddrH (0x80: not used), Device, Ports
+    {0, 0x80, 1, 4},       //       114  R/W    Window 3
+    {0, 0x80, 1, 4}},      //       118  R/W    Window 4
+   0,           // SafeMode    122  R/W    Safe state on broadcasts: none (opt-in, see cv_define.h)
+   0b01010101,  // SafePattern 123  R/W    Safe state: all relays RED (as after init_relay_and_block)
+   0,           // PowerFB     124  R/W    Feedback bit (1..8) for "DCC signal lost". 0: not used
+   {0, 0, 0, 0, // ThresholdOn 125  R/W    Threshold_on per input. 0: use CV35
+    0, 0, 0, 0},//             129  R/W    
+   {0, 0, 0, 0, // ThresholdOff 133 R/W    Threshold_of per input. 0: use CV36
+    0, 0, 0, 0},//             137  R/W    
+   5,           // CalMargin   141  R/W    Margin (ADC steps) above the noise of an empty track
+   0,           // Calibrate   142  W      Start the calibration (seconds; 0: 5s). Not saved
+   {0, 0, 0, 0, // IdleLevel   143  R/W    Idle level per input, set by the calibration
+    0, 0, 0, 0},//             147  R/W    
+   0,           // DriftLimit  151  R/W    Max shift of the thresholds with the baseline. 0: none
@@ -29,6 +29,18 @@
 //            2012-01-03 v0.3 ap New Cvs for GBM added. 
 //            2012-12-27 v0.4 ap Cvs have been reorded and cleaned up, to better support PoM.
 //            2013-03-12 v0.5 ap The ability is added to program the CVs on the main (PoM).
+//            2026-10-16 v0.6    RepeatWin added, CV26 resets the DCC statistics,
+//                               CV28 enables the RailCom cutout measurement
+//            2026-10-16 v0.7    ShortAddr added
+//            2026-10-16 v0.8    FuncMap added (actions for F5..F28)
+//            2026-10-16 v0.9    AspectMap added (extended accessory aspects), Config is R/W
+//            2026-10-16 v0.A    Window added (accessory address windows 2..4)
+//            2026-10-16 v0.B    SafeMode and SafePattern added (broadcast stop)
+//            2026-10-16 v0.C    PowerFB added (DCC signal lost)
+//            2026-10-16 v0.D    ThresholdOn, ThresholdOff, CalMargin, Calibrate and IdleLevel added
+//                               (occupancy thresholds per input, calibration)
+//            2026-10-16 v0.E    DriftLimit added (thresholds follow the baseline)
+//                               CV125 .. CV151 are not in the SRAM copy (CV_RAM_SIZE)
 //
 //
 //------------------------------------------------------------------------
@@ -39,6 +51,15 @@
 //
 //========================================================================
 
+// An additional accessory address window (3 of these follow the CV of window 1: CV1/CV9)
+typedef struct
+  {
+    unsigned char AddrL;        // Decoder address low (6 bits), like CV1
+    unsigned char AddrH;        // Decoder address high (3 bits), like CV9. 0x80: window not used
+    unsigned char Device;       // First relays (1..4) of the window
+    unsigned char Ports;        // Number of port (switch) addresses in the window
+  } t_cv_window;
+
 typedef struct
   {
     //            Name          CV   alt  Access comment
@@ -68,10 +89,10 @@ typedef struct
     unsigned char Search;       //535  23  R/W*   If set to 1: decoder LED blinks. Value will be 0 after restart
     unsigned char cv536;        //536  24  R      not used
     unsigned char Restart;      //537  25  R/W*   To restart (as opposed to reset) the decoder: use after PoM write
-    unsigned char DccQuality;   //538  26  R      DCC Signal Quality
+    unsigned char DccQuality;   //538  26  R/W*   DCC checksum errors (max. 255). Write: reset DCC statistics
     unsigned char DecType;      //539  27  R      Decoder Type (see global.h for possible values)
-    unsigned char BiDi;         //540  28  R      Bi-Directional Communication Config. Since BiDi is not used, keep at 0
-    unsigned char Config;       //541  29  R      Accessory Decoder configuration (similar to CV#29)
+    unsigned char BiDi;         //540  28  R/W    Bi-Directional Communication Config. If not 0: measure RailCom cutout
+    unsigned char Config;       //541  29  R/W    Accessory Decoder configuration (similar to CV#29)
     unsigned char VID_2;        //542  30  R      Second Vendor ID, to detect AP decoders
     unsigned char cv543;        //543  31  R      not used
     unsigned char cv544;        //544  32  R      not used
@@ -110,8 +131,43 @@ typedef struct
     unsigned char FB_S4;        //565  50  R/W    Feedback bit if Sensor 4 is active
     unsigned char Polarization; //566  51  R/W    If 0: J&K connected normal / if 1: J&K polarization changed
 
+    // CVs used by the DCC decoder
+    unsigned char RepeatWin;    //567  52  R/W    Window (in 20ms steps, 1..127) in which equal packets are repeats
+                                                    // of the first one (it does not slide); after the
+                                                    // window, the same command is accepted again
+    unsigned char ShortAddr;    //568  53  R/W    Short loco address (1..127) for PoM and F1..F4. 0: not used
+    unsigned char FuncMap[24];  //569  54  R/W    Action for F5 .. (CV77) F28, see relays.c:
+                                                    // 0: none, 1..4: relays 1..4, 5: all relays 
+                                                    // (reverser), 6: LED search (the LED blinks
+                                                    // while the function is on, like CV23)
+    unsigned char AspectMap[32];//593  78  R/W    RELAYS_PORT pattern for aspect 0 .. (CV109) 31
+                                                    // of extended accessory packets, see relays.c
+    t_cv_window Window[3];      //625 110  R/W    Accessory address windows 2 .. 4 (CV110 .. CV121)
+                                                    // window 1 is CV1/CV9, see dcc_decode.c
+    unsigned char SafeMode;     //637 122  R/W    Broadcasts that put the relays in the safe state:
+                                                    // bit 0: emergency stop, bit 1: stop, bit 2:
+                                                    // accessory broadcast, see dcc_decode.c.
+                                                    // Default 0: no safe state
+    unsigned char SafePattern;  //638 123  R/W    RELAYS_PORT pattern of the safe state (as AspectMap)
+    unsigned char PowerFB;      //639 124  R/W    Feedback bit (1..8) that is 1 while the DCC signal
+                                                    // is lost, see occupancy.c. 0: not used
+    unsigned char ThresholdOn[8];//640 125 R/W    Threshold_on for input 1 .. (CV132) 8. 0: use CV35
+    unsigned char ThresholdOff[8];//648 133 R/W   Threshold_of for input 1 .. (CV140) 8. 0: use CV36
+    unsigned char CalMargin;    //656 141  R/W    Margin above the noise of an empty track, used by the
+                                                    // calibration to set CV125 .. CV140
+    unsigned char Calibrate;    //657 142  W      Start the calibration (track empty), value is the
+                                                    // measuring time in seconds (0: 5s). Not saved
+    unsigned char IdleLevel[8]; //658 143  R/W    Idle level of input 1 .. (CV150) 8 (empty track), set by
+                                                    // the calibration. Reference for the drift
+    unsigned char DriftLimit;   //666 151  R/W    Max shift (ADC steps) of the thresholds with the baseline
+                                                    // of an input, see adc_hardware.c. 0: no drift tracking
     
  } t_cv_record;
 
+// The SRAM copy of the record (CV_RAM, see config.c) ends before CV125. The thresholds,
+// idle levels and the other calibration CVs are only read at startup and by the
+// calibration, and adc_hardware.c keeps them in its own variables
+#define CV_RAM_SIZE   offsetof(t_cv_record, ThresholdOn)
+
 
 #endif
@@ -16,7 +16,7 @@
 //   RecCvNumber
 //   RecCvData 
 //   RecCvOperation
-//   DccSignalQuality
+//   dcc_errors
 //
 //*****************************************************************************************************
 #include <stdlib.h>
@@ -33,32 +33,28 @@
 #include "hardware.h"		// port definitions
 
 #include "dcc_receiver.h"	// receiver for dcc
+#include "dcc_decode.h"		// restart after service mode
 
 #include "rs_bus_hardware.h"	// to check if we have an active RS-bus connection
 #include "rs_bus_messages.h"	// for sending RS-bus feedback messages (after POM)
 #include "led.h"                // LED specific functions
+#include "adc_hardware.h"	// calibration of the occupancy thresholds
 
 
 
 //***************************************************************************************
 // Local variables
 //***************************************************************************************
-// The NMRA specs say we only react if a PoM message is received for the second time
-// The LENZ LZV100 does always send a messages four times (thus 3 retranmission)
-// The next variables are used to count the number of retransmissions.
-unsigned int  PoM_CV_Current = 0;	// The CV PoM is currently targetting
-unsigned char PoM_Value = 0;		// The value in the PoM command
-unsigned char PoM_Prev_CV_Oper = 0; 	// The Operation PoM is currently targetting
-unsigned char PoM_Attempt = 0;		// To count the number of PoM retransmissions
-unsigned int  T_PoM_TimeOut = 0;	// Used to time out PoM retransmission messages
-
-
 // Some CV Values should start from 0 after each decoder restart. Therefore these values
 // should not be stored in EEPROM. Still we have to maintain these variables, to allow
 // rerieving their value via a CV verify command.
 unsigned char LocalCV23;		// Local copy of CV23 (find function: LED blinks)
 unsigned char LocalCV24;		// Local copy of CV24 (PoMStart)
 
+// Value of a CV (0 = CV1), from the SRAM copy of the CV record, or from EEPROM for the
+// CVs after CV_RAM_SIZE (see myeeprom.h). The CV number must have been checked against sizeof(CV)
+#define CV_VALUE(cv)  my_eeprom_read_byte((const unsigned char *) &CV + (cv))
+
 
 //***************************************************************************************
 // Decoder specific part / should be changed for different hardware
@@ -72,15 +68,26 @@ unsigned char LocalCV24;		// Local copy of CV24 (PoMStart)
 // - CV11-CV18 (DelayIn1 .. DelayIn8)
 // - CV19-CV21 (CmdStation, RSRetry, SkipUnEven)
 // - CV27      (DecType)
+// - CV28      (BiDi)
+// - CV29      (Config: basic or extended accessory decoder)
 // - CV33-CV51 (Various Feedback specific CVs)
+// - CV52      (RepeatWin)
+// - CV53      (ShortAddr)
+// - CV54-CV77 (FuncMap: actions for F5..F28)
+// - CV78-CV109 (AspectMap: relays patterns for extended accessory aspects)
+// - CV110-CV121 (Window: accessory address windows 2..4)
+// - CV122-CV124 (SafeMode, SafePattern, PowerFB)
+// - CV125-CV141 (ThresholdOn, ThresholdOff: thresholds per input, CalMargin)
+// - CV143-CV151 (IdleLevel, DriftLimit: baseline drift of the inputs)
 
 unsigned char save_cv_value_in_EEPROM(unsigned int cv)
 { unsigned int cvNumber = cv + 1; // cv starts with 0
   if  (cvNumber == 1) return(1);
   if  (cvNumber == 9) return(1);
   if ((cvNumber >= 10) && (cvNumber <= 21)) return(1);
-  if  (cvNumber == 27) return(1);
-  if ((cvNumber >= 33) && (cvNumber <= 51)) return(1);
+  if ((cvNumber >= 27) && (cvNumber <= 29)) return(1);
+  if ((cvNumber >= 33) && (cvNumber <= 141)) return(1);
+  if ((cvNumber >= 143) && (cvNumber <= 151)) return(1);
   return(0);
 }
 
@@ -114,12 +121,115 @@ void ResetDecoder(void)
 }
 
 
+//***************************************************************************************
+// Initialise the CVs that are new since the software version in EEPROM
+//***************************************************************************************
+// The Arduino IDE (and a flash without the .eep file) keeps the EEPROM of the previous
+// software. The CVs from RepeatWin (CV52) on did not exist in version 0x10, and read 0xFF:
+// for most of them an invalid or harmful value (CV125..CV140 = 255 disable the detection, 
+// SafeMode = 255 enables every safe state trigger). These CVs get their default values; 
+// all other CVs (addresses, thresholds) are kept.
+void UpgradeDecoder(void)
+{ unsigned char *eeptr;
+  const unsigned char *pgmptr;
+  unsigned char default_value;
+  LED_ON;
+  eeptr = (unsigned char *) &CV.RepeatWin;
+  pgmptr = (const unsigned char *) &CV_PRESET.RepeatWin;
+  while (eeptr < (unsigned char *) &CV + sizeof(CV))
+  { default_value = pgm_read_byte(pgmptr);
+    if (my_eeprom_read_byte(eeptr) != default_value) my_eeprom_write_byte(eeptr, default_value);
+    eeptr++;
+    pgmptr++;
+  }
+  my_eeprom_write_byte(&CV.version, pgm_read_byte(&CV_PRESET.version));
+  eeprom_busy_wait();
+  LED_OFF;
+}
+
+
+//***************************************************************************************
+// Diagnostic CVs
+//***************************************************************************************
+// The receiver statistics can be read (PoM verify only) as 16 bit values. Each value 
+// occupies two CVs: the low byte at an even CV number, the high byte at the next one.
+// Writing any value to CV26 resets the error and cutout counters.
+// CV200/201: valid DCC packets per second
+// CV202/203: idle packets, in % of the valid packets
+// CV204/205: time (in 20ms ticks) since the last valid packet
+// CV206/207: longest time (in 20ms ticks) without valid packets
+// CV208/209: checksum errors
+// CV210/211: preambles broken off too early
+// CV212/213: packets dropped because main could not keep up (ring overflow)
+// CV214/215: packets longer than 6 bytes
+// CV216/217: framing errors
+// CV218/219: sample point (us after the rising edge), adapted to the signal
+// CV220/221: margin (us) between the sample point and the nearest measured edge
+// CV222/223: measured half-bit of a 1 (us)
+// CV224/225: measured half-bit of a 0 (us)
+// CV226/227: RailCom cutouts detected (only if CV28 BiDi is not 0)
+// CV228/229: RailCom cutouts outside the NMRA limits
+// CV230/231: packet end bits without a RailCom cutout
+// CV232/233: start of the last cutout (us after the end bit; 0: not visible)
+// CV234/235: end of the last cutout (us after the end bit)
+// CV236/237: length of the last cutout (us; 0: start not visible)
+// CV238/239: DCC signal present (1) or lost (0)
+// CV240/241: valid packets in the last 100ms window
+// CV242/243: received bits in the last 100ms window (0: no signal at all)
+// CV244/245: number of times the DCC signal was lost
+// CV246/247 .. CV260/261: baseline (idle level, tracked while free) of input 1 .. 8
+#define FIRST_DIAG_CV   200
+#define LAST_DIAG_CV    261
+
+unsigned char is_diagnostic_cv(unsigned int cv)
+{ unsigned int cvNumber = cv + 1; // cv starts with 0
+  return((cvNumber >= FIRST_DIAG_CV) && (cvNumber <= LAST_DIAG_CV));
+}
+
+unsigned char read_diagnostic_cv(unsigned int cv)
+{ unsigned int value;
+  unsigned char index = (cv + 1 - FIRST_DIAG_CV);
+  switch (index >> 1) {
+    case 0:  value = dcc_statistics.packets; break;
+    case 1:  value = dcc_statistics.idle_percent; break;
+    case 2:  value = dcc_statistics.since_valid; break;
+    case 3:  value = dcc_statistics.longest_gap; break;
+    case 4:  value = dcc_read_counter(&dcc_errors.checksum); break;
+    case 5:  value = dcc_read_counter(&dcc_errors.preamble); break;
+    case 6:  value = dcc_read_counter(&dcc_ring_overflows); break;
+    case 7:  value = dcc_read_counter(&dcc_errors.too_long); break;
+    case 8:  value = dcc_read_counter(&dcc_errors.framing); break;
+    case 9:  value = dcc_timing.sample_point; break;
+    case 10: value = dcc_timing.margin; break;
+    case 11: value = dcc_timing.half1; break;
+    case 12: value = dcc_timing.half0; break;
+    case 13: value = dcc_read_counter(&dcc_cutout.detected); break;
+    case 14: value = dcc_read_counter(&dcc_cutout.detected)
+                   - dcc_read_counter(&dcc_cutout.compliant); break;
+    case 15: value = dcc_read_counter(&dcc_cutout.missing); break;
+    case 16: value = dcc_cutout.start; break;
+    case 17: value = dcc_cutout.end; break;
+    case 18: value = dcc_cutout.length; break;
+    case 19: value = dcc_presence.present; break;
+    case 20: value = dcc_presence.packets; break;
+    case 21: value = dcc_presence.bits; break;
+    case 22: value = dcc_presence.losses; break;
+    case 23: case 24: case 25: case 26:
+    case 27: case 28: case 29: case 30:
+             value = adc_baseline[(index >> 1) - 23]; break;
+    default: value = 0; break;
+  }
+  if (index & 1) return(value >> 8);
+  return(value & 0xFF);
+}
+
+
 //***************************************************************************************
 // CV Verify code
 //***************************************************************************************
 void cv_verify_sm(void)
 { // For Service Mode programming we implement verify command according to NMRA specs.
-  if (my_eeprom_read_byte(&CV.myAddrL + RecCvNumber) == RecCvData) activate_ACK(6);
+  if (CV_VALUE(RecCvNumber) == RecCvData) activate_ACK(6);
 }
 
 void cv_verify_pom(void)
@@ -128,14 +238,21 @@ void cv_verify_pom(void)
   // Such behavior is useful for Service Mode Programming, but not for PoM.
   // Since we can send information back via the RS-bus, we modify this behavior
   // and send the value stored in the decoder back.
-  // Note that all CV values can be retrieved from EEPROM, except:
+  // Note that all CV values can be retrieved with CV_VALUE, except:
   // - CV23 (find function which blinks led)
   // - CV24 (PoM Start)
-  // - CV26 (DccQuality)
+  // - CV26 (DccQuality: number of checksum errors, up to 255)
+  // - the diagnostic CVs
+  unsigned int checksum_errors;
   if      (RecCvNumber == (23-1)) send_CV_value_via_RSbus(LocalCV23);
   else if (RecCvNumber == (24-1)) send_CV_value_via_RSbus(LocalCV24);
-  else if (RecCvNumber == (26-1)) send_CV_value_via_RSbus(DccSignalQuality);
-  else send_CV_value_via_RSbus(my_eeprom_read_byte(&CV.myAddrL + RecCvNumber));
+  else if (RecCvNumber == (26-1)) {
+    checksum_errors = dcc_read_counter(&dcc_errors.checksum);
+    if (checksum_errors > 255) checksum_errors = 255;
+    send_CV_value_via_RSbus(checksum_errors);
+  }
+  else if (is_diagnostic_cv(RecCvNumber)) send_CV_value_via_RSbus(read_diagnostic_cv(RecCvNumber));
+  else send_CV_value_via_RSbus(CV_VALUE(RecCvNumber));
 }
 
 
@@ -153,20 +270,21 @@ void cv_bitoperation_sm(void)
   if (RecCvData & 0b00010000)
   { // write bit
     if (save_cv_value_in_EEPROM (RecCvNumber)) {
-      oldbyte = my_eeprom_read_byte(&CV.myAddrL + RecCvNumber);
+      oldbyte = CV_VALUE(RecCvNumber);
       if (RecCvData & 0b00001000) oldbyte |= bitmask;
       else                        oldbyte &= ~bitmask;
       my_eeprom_write_byte(&CV.myAddrL + RecCvNumber, oldbyte);
       eeprom_busy_wait();
       activate_ACK(6);
+      restart_after_service_mode();
     }
   }
   else
   { // verify bit
     if (RecCvData & 0b00001000)
-    { if (my_eeprom_read_byte(&CV.myAddrL + RecCvNumber) & bitmask) activate_ACK(6); }
+    { if (CV_VALUE(RecCvNumber) & bitmask) activate_ACK(6); }
     else
-    { if ((my_eeprom_read_byte(&CV.myAddrL + RecCvNumber) & bitmask) == 0) activate_ACK(6);}
+    { if ((CV_VALUE(RecCvNumber) & bitmask) == 0) activate_ACK(6);}
   }
 }
 
@@ -174,24 +292,18 @@ void cv_bitoperation_sm(void)
 // Main function
 //***************************************************************************************
 void cv_operation(unsigned char op_mode)
-{  // Ensure we only react on the second transmission of the same PoM message
-  if ((PoM_CV_Current == RecCvNumber) && (PoM_Value == RecCvData) && (PoM_Prev_CV_Oper == RecCvOperation))
-  {
-    PoM_Attempt ++;		// Count the number of retransmissions
-  }
-  else {
-    PoM_Attempt = 1;
-    PoM_CV_Current = RecCvNumber;
-    PoM_Value = RecCvData;
-    PoM_Prev_CV_Oper = RecCvOperation;
-  }
-  if (PoM_Attempt != 2) return;
-  // If we're here we received the same PoM message for the second time.
+{  // analyze_message only returns PoM and SM commands for the second transmission of 
+  // the same message (see the repeat cache in dcc_decode.c)
   // CV Remapping: CV513 = CV1
   RecCvNumber &= 0x1FF;
   // Stop processing if we don't have a valid CV address
   // Thus *protect other memory from (accidentally) getting overwritten.
   // Note addresses on the wire start with 0, whereas counting starts with 1
+  // The diagnostic CVs are outside the CV record, and can only be read via PoM
+  if (is_diagnostic_cv(RecCvNumber)) {
+    if ((op_mode == POM_CMD) && (RecCvOperation == CV_VERIFY)) cv_verify_pom();
+    return;
+  }
   if (RecCvNumber > (sizeof(CV) - 1)) return;
   switch(RecCvOperation) {
     case CV_NOP: break;
@@ -211,21 +323,34 @@ void cv_operation(unsigned char op_mode)
       if ((RecCvNumber == (25-1)) && (RecCvData)) { 
         _restart();                         // really hard exit
       }
+      // Reset the DCC error and cutout counters if CV26 is written
+      if (RecCvNumber == (26-1)) {
+        dcc_statistics_reset();
+        break;
+      }
+      // Calibrate the occupancy thresholds if CV142 is written. The track must be empty
+      if (RecCvNumber == (142-1)) {
+        start_calibration(RecCvData);
+        if (op_mode == SM_CMD) activate_ACK(6);
+        break;
+      }
       // Search function: blink the decoder's LED if CV23 is set to 1. 
       // Continue blinking until CV23 is set to 0
       if (RecCvNumber == (23-1)) { 
-        if (RecCvData) {LocalCV23 = 1; flash_led_fast(8);}
-        else {LocalCV23 = 0; turn_led_off();}
+        LocalCV23 = RecCvData ? 1 : 0;
+        search_led(LED_SEARCH_CV23, LocalCV23);
         break;
       }
       // Check if the value of the received CV should be saved in EEPROM
       if (save_cv_value_in_EEPROM (RecCvNumber)) {
         my_eeprom_write_byte(&CV.myAddrL + RecCvNumber, RecCvData);
         eeprom_busy_wait();
-        if (op_mode == SM_CMD) {activate_ACK(6); _restart();}
+        // In service mode the restart follows when service mode ends, since the programmer
+        // may continue with other CVs
+        if (op_mode == SM_CMD) {activate_ACK(6); restart_after_service_mode();}
       }
       // Check if we've changed the RS-bus address. If yes: restart
-      if (RecCvNumber == (10-1)) _restart();
+      if ((RecCvNumber == (10-1)) && (op_mode != SM_CMD)) _restart();
       break;
     case CV_BITOPERATION: 
       // CV Bit Operation is only implemented for Service Mode
@@ -234,16 +359,3 @@ void cv_operation(unsigned char op_mode)
   } 
 }
 
-
-//***************************************************************************************
-// Time out to allow processing of the same CV after 2 seconds has passed
-//***************************************************************************************
-void check_PoM_time_out(void) { 
-  // this function is called from main every 20 seconds
-  // maintain a counter, to time-out after 2 seconds
-  T_PoM_TimeOut ++;
-  if (T_PoM_TimeOut > 100) {		// 2s have passed since previous PoM message
-    PoM_Attempt = 0;			// Forget previous POM messages
-    T_PoM_TimeOut = 0;			// Reintialise timeout (is strictly speaking not needed)
-  }
-}
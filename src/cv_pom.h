@@ -16,7 +16,7 @@
 // file:      cv_pom.h
 
 void ResetDecoder(void);
+void UpgradeDecoder(void);
 void cv_operation(unsigned char op_mode);
-void check_PoM_time_out(void);
 
 #endif
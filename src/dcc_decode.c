@@ -43,6 +43,18 @@
 //                               Returns with accessory data, PoM data or F1..F4 data 
 //                               PoM is moved to cv_pom.c 
 //            2020-09-08 v0.B ap SkipEven => SkipUnEven
+//            2026-10-16 v0.C    The checksum is verified by the dcc_receiver
+//                               init_dcc_decode sets the receiver's address prefilter
+//                               Repeat cache: one duplicate rule for all kinds of commands
+//                               Table driven classification of the first byte; CmdStation
+//                               and SkipUnEven are read once by init_dcc_decode
+//                               Short (7 bit) loco address for PoM and F1..F4 (CV53)
+//                               Function group two (F5..F12) and F13..F28 expansion
+//                               Up to ACC_WINDOWS accessory address windows (CV110..CV121)
+//                               Service mode: paged and register mode, restart only at the
+//                               end of service mode
+//                               Broadcast (emergency) stop and accessory broadcast put the relays
+//                               in the safe state, directly from the decoder (CV122, CV123)
 
 //
 // purpose:   flexible general purpose decoder for dcc
@@ -74,6 +86,7 @@
 #include "rs_bus_messages.h"     // for sending RS-bus feedback messages (after POM)
 #include "timer1.h"              // For the LED blinking routine 
 #include "cv_pom.h"         	 // CV programming
+#include "relays.h"		 // safe state after a broadcast stop
 
 #include "lcd.h"		 // Peter Fleury's LCD routines
 #include "lcd_ap.h"		 // Included by AP for debugging purposes
@@ -94,96 +107,221 @@
 unsigned char service_mode_state;	// bit field
 #define SM_ENABLED   0			// Bit 0: 0: normal operation
 					//        1: service mode
-#define SM_RECEIVED  1			// Bit 1: 0: initial state
-					//        1: there is already a received SM
+#define SM_RESTART   1			// Bit 1: 0: initial state
+					//        1: restart when service mode ends
+#define SM_FILTER    2			// Bit 2: 1: the prefilter was enabled before service mode
                           
 signed char last_sm_mode_received;	// timer variable to create a update grid;
+unsigned char sm_page;			// page register for paged mode (1 after power up)
 
-unsigned int  MyFirstAdrPlusCoil;	// First "global" address this decoder listens to
-unsigned int  MyLastAdrPlusCoil;	// "global" address = switch address LH100 - 1
 unsigned char RecF1_F4;			// Received value of F1..F4
 unsigned char LastRecF1_F4;    	 	// Bit0=F1, Bit1=F2, Bit2=F3, Bit3=F4 
 					// If 255: we are not yet initialized
+unsigned char LastRecFunc[4];		// Last values of F5..F8, F9..F12, F13..F20, F21..F28
+unsigned char RecFuncKnown;		// Bit per group of LastRecFunc: 1 if initialized
+unsigned char LenzCorrection;		// CV.CmdStation == 1: correct LENZ accessory addresses
+unsigned char TargetShift;		// 1 if SkipUnEven (two ports per device), else 0
+					// Both are read at init: use CV25 to restart after PoM
+
 
 //***************************************************************************************
-// Service Mode message (programming on the special programming track)
+// Classification of the first byte
 //***************************************************************************************
-// Service Mode is not supported for GBM decoders, since they are powered from the track
-// The code below has not been tested after the complete restructure
-unsigned char analyze_service_mode_message(t_message *new_dcc)
-{
-  if ((char)(timerval - last_sm_mode_received) >= (SERVICE_MODE_TIMEOUT / TICK_PERIOD))
-  {
-    service_mode_state = 0;                    // timeout reached, leave service mode
-  }
-  if (new_dcc->dcc[0] == 0)
-  {
-    if (new_dcc->dcc[1] == 0)
-    { // reset message - enter service mode
-      service_mode_state = (1 << SM_ENABLED);
-      last_sm_mode_received = timerval;
-      return(IGNORE_CMD);
-    }
+// The first byte of a packet determines the kind of packet (see RP 9.2.1). The table
+// maps every possible first byte directly to the handler in analyze_message, instead of 
+// a chain of comparisons. Basic and extended accessory packets share the first byte; 
+// analyze_accessory_message separates them using the second byte.
+#define CLASS_IGNORE          0		// reserved (232..254) and idle (255)
+#define CLASS_BROADCAST       1		// 00000000
+#define CLASS_LOCO_7BIT       2		// 0AAAAAAA
+#define CLASS_ACCESSORY       3		// 10AAAAAA
+#define CLASS_LOCO_14BIT      4		// 11AAAAAA (192..231)
+
+const unsigned char dcc_class[256] PROGMEM =
+  { [0]           = CLASS_BROADCAST,
+    [1 ... 127]   = CLASS_LOCO_7BIT,
+    [128 ... 191] = CLASS_ACCESSORY,
+    [192 ... 231] = CLASS_LOCO_14BIT,
+    [232 ... 255] = CLASS_IGNORE
+  };
+
+
+//***************************************************************************************
+// Repeated packets
+//***************************************************************************************
+// Command stations repeat accessory, function and PoM packets several times (the LENZ 
+// LZV100 sends each message four times), often interleaved with the refresh packets for
+// the same loco. The last distinct packets are kept in a small associative cache: a new
+// packet is compared with all entries. A packet is a repeat if it is equal to a cached 
+// packet, and its first occurrence was at most RepeatWindow ticks (20ms) ago. The window
+// does not slide: a packet that keeps coming is seen as new again once per window, so the
+// user can repeat a command (such as the same turnout position) after RepeatWindow. 
+// A new packet replaces the packet for the same target (see same_target()), so switch 
+// A -> B -> A is still seen as three new commands; else it takes a free or the oldest entry.
+// analyze_message stores the occurrence in RecRepeat, and applies the policy per command.
+#if (SRAM_SIZE <= 512)
+  #define REPEAT_CACHE_SIZE   4
+#else
+  #define REPEAT_CACHE_SIZE   8
+#endif
+
+typedef struct
+  { t_message msg;			// the packet (size 0: slot is free)
+    signed char first_seen;		// timerval of the first occurrence
+    unsigned char count;		// number of occurrences, saturates at 255
+  } t_repeat_entry;
+
+t_repeat_entry repeat_cache[REPEAT_CACHE_SIZE];
+unsigned char RepeatWindow;		// CV.RepeatWin, limited to 127 because timerval wraps
+
+
+// Two packets are for the same target if they have the same size and address, and only 
+// differ in their data: for a basic accessory the gate and activate bits (each port is a 
+// target of its own), for an extended accessory the aspect, and for a loco the bits after
+// the 3 instruction bits (feature expansion instructions 110xxxxx must match completely).
+// PoM and speed packets for the same loco are different targets.
+unsigned char same_target(t_message *a, t_message *b)
+{ unsigned char i = 1;			// the instruction byte
+  if ((a->size != b->size) || (a->dcc[0] != b->dcc[0])) return(0);
+  switch (pgm_read_byte(&dcc_class[a->dcc[0]]))
+  { case CLASS_ACCESSORY:
+      return(((a->dcc[1] ^ b->dcc[1]) & 0b11110110) == 0);	// 1AAA0DD0 or 0AAA0AA0
+    case CLASS_LOCO_14BIT:
+      if (a->dcc[1] != b->dcc[1]) return(0);
+      i = 2;
+      // fall through
+    case CLASS_LOCO_7BIT:
+      if ((a->dcc[i] & 0b11100000) == 0b11000000) return(a->dcc[i] == b->dcc[i]);
+      return(((a->dcc[i] ^ b->dcc[i]) & 0b11100000) == 0);
+    default:				// broadcast
+      return(1);
   }
-  else if ((new_dcc->dcc[0] >= 112) && (new_dcc->dcc[0] <= 127))
-  {
-    if (new_dcc->size == 4) // direct mode
-    {
-      service_mode_state |= (1 << SM_ENABLED);
-      last_sm_mode_received = timerval;
-      // direct mode
-      // {preamble} 0 0111CCAA 0 AAAAAAAA 0 DDDDDDDD 0 EEEEEEEE 1
-      // CC = 11: write
-      // CC = 01: verify
-      // CC = 10: bit op
-      // {preamble} 0 0111CCAA 0 AAAAAAAA 0 111KDBBB 0 EEEEEEEE 1
-      //  K = (1=write, 0=verify) D = Bitvalue, BBB = bitpos
-      if (service_mode_state & (1 << SM_RECEIVED))
-      {  // this is the second message
-        unsigned int tempi;
-        unsigned char tempc;
-        tempc = (new_dcc->dcc[0] & 0b00001100);// CC bits
-        tempc = tempc >> 2; // CC bits
-        
-        tempi = ((new_dcc->dcc[0] & 0b00000011) << 8)
-        | new_dcc->dcc[1];
-        
-        if ( (tempc == RecCvOperation) &&
-            (tempi == RecCvNumber) &&
-            (new_dcc->dcc[2] == RecCvData)  )
-        {
-          return (SM_CMD);
-          // cv_operation();
+}
+
+
+unsigned char repeat_count(t_message *new_dcc)
+{ t_repeat_entry *entry;
+  t_repeat_entry *target = 0;		// entry with the packet for the same target
+  t_repeat_entry *spare = repeat_cache;	// free or oldest entry
+  unsigned char age, oldest = 0;
+  unsigned char i, j;
+  for (i = 0; i < REPEAT_CACHE_SIZE; i++)
+  { entry = &repeat_cache[i];
+    if (entry->msg.size == 0) age = 255;	// free entries first
+    else
+    { if (same_target(&entry->msg, new_dcc))
+      { for (j = 1; j < new_dcc->size; j++)
+          if (entry->msg.dcc[j] != new_dcc->dcc[j]) break;
+        if ((j == new_dcc->size) && ((unsigned char)(timerval - entry->first_seen) <= RepeatWindow))
+        { if (entry->count < 255) entry->count++;
+          return(entry->count);
         }
-        service_mode_state &= ~(1 << SM_RECEIVED);
-      }
-      else
-      {
-        service_mode_state |= (1 << SM_RECEIVED);   // we have a sm message
-        RecCvOperation = (new_dcc->dcc[0] & 0b00001100);  // CC bits
-        RecCvOperation = RecCvOperation >> 2;
-        RecCvNumber = ((new_dcc->dcc[0] & 0b00000011) << 8) | new_dcc->dcc[1];
-        RecCvData = new_dcc->dcc[2];
+        target = entry;
       }
+      age = (unsigned char)(timerval - entry->first_seen);
     }
-    if (new_dcc->size == 3) // paged/register mode
-    {
-      service_mode_state |= (1 << SM_ENABLED);
-      last_sm_mode_received = timerval;
-      // paged/register mode
-      // {preamble} 0 0111CRRR 0 DDDDDDDD 0 EEEEEEEE 1
-      // C = 1: write
-      // C = 0: verify
-      // RRR = Register
-      // !!!! Note: this is not supported !!!!
-    }
+    if (age > oldest) { oldest = age; spare = entry; }
+  }
+  entry = target ? target : spare;	// a new packet
+  entry->msg = *new_dcc;
+  entry->first_seen = timerval;
+  entry->count = 1;
+  return(1);
+}
+
+
+void check_repeat_time_out(void)
+{ // This function is called from main every 20ms. Free the slots that are outside the 
+  // window, to avoid that an old packet looks recent again once timerval wraps around
+  unsigned char i;
+  for (i = 0; i < REPEAT_CACHE_SIZE; i++)
+    if ((unsigned char)(timerval - repeat_cache[i].first_seen) > RepeatWindow) repeat_cache[i].msg.size = 0;
+}
+
+//***************************************************************************************
+// Service Mode message (programming on the special programming track)
+//***************************************************************************************
+// Service mode is entered by a reset packet, see analyze_broadcast_message(), and ends 
+// after SERVICE_MODE_TIMEOUT without reset or service mode packets, or as soon as another 
+// packet (except idle) is received. The command is executed on the second identical 
+// packet, as for all SM commands (see analyze_message).
+// CV writes in service mode do not restart the decoder immediately, since a programmer
+// may read or write many CVs in one session. The restart, which makes the new values 
+// take effect, follows when service mode ends.
+// Note that GBM decoders are powered from the track. On a programming track with a 
+// current limit, the decoder may not be able to start.
+void leave_service_mode(void)
+{ unsigned char restart = service_mode_state & (1 << SM_RESTART);
+  if (service_mode_state & (1 << SM_FILTER)) dcc_filter.enabled = 1; // see analyze_broadcast_message
+  service_mode_state = 0;
+  if (restart) _restart();                     // really hard exit
+}
+
+
+void restart_after_service_mode(void)
+{ service_mode_state |= (1 << SM_RESTART);
+}
+
+
+void check_service_mode_time_out(void)
+{ // This function is called from main every 20ms
+  if (!(service_mode_state & (1 << SM_ENABLED))) return;
+  if ((signed char)(timerval - last_sm_mode_received) >= (SERVICE_MODE_TIMEOUT / TICK_PERIOD))
+    leave_service_mode();                      // timeout reached, leave service mode
+}
+
+
+unsigned char analyze_service_mode_message(t_message *new_dcc)
+{ unsigned char reg;
+  if (new_dcc->dcc[0] == 0)
+  { if (new_dcc->dcc[1] == 0) last_sm_mode_received = timerval; // reset message: stay in service mode
+    else leave_service_mode();                 // another broadcast command
     return(IGNORE_CMD);
   }
-  else if (new_dcc->dcc[0] == 255)
-  {
-    last_sm_mode_received = timerval;
+  if (new_dcc->dcc[0] == 255) return(IGNORE_CMD); // idle
+  if ((new_dcc->dcc[0] < 112) || (new_dcc->dcc[0] > 127))
+  { leave_service_mode();                      // not a service mode packet
     return(IGNORE_CMD);
   }
+  last_sm_mode_received = timerval;
+  if (new_dcc->size == 4) // direct mode
+  { // {preamble} 0 0111CCAA 0 AAAAAAAA 0 DDDDDDDD 0 EEEEEEEE 1
+    // CC = 11: write
+    // CC = 01: verify
+    // CC = 10: bit op
+    // {preamble} 0 0111CCAA 0 AAAAAAAA 0 111KDBBB 0 EEEEEEEE 1
+    //  K = (1=write, 0=verify) D = Bitvalue, BBB = bitpos
+    RecCvOperation = (new_dcc->dcc[0] & 0b00001100);  // CC bits
+    RecCvOperation = RecCvOperation >> 2;
+    RecCvNumber = ((new_dcc->dcc[0] & 0b00000011) << 8) | new_dcc->dcc[1];
+    RecCvData = new_dcc->dcc[2];
+    return(SM_CMD);
+  }
+  if (new_dcc->size == 3) // paged/register mode
+  { // {preamble} 0 0111CRRR 0 DDDDDDDD 0 EEEEEEEE 1
+    // C = 1: write
+    // C = 0: verify
+    // RRR = Register (register 1..8 in the NMRA numbering):
+    //   0..3: CV (page - 1) * 4 + RRR + 1. Physical register mode uses page 1: CV1..CV4
+    //   4: CV29, 5: the page register, 6: CV7, 7: CV8
+    if (new_dcc->dcc[0] & 0b00001000) RecCvOperation = CV_WRITE;
+    else RecCvOperation = CV_VERIFY;
+    RecCvData = new_dcc->dcc[1];
+    reg = new_dcc->dcc[0] & 0b00000111;
+    switch (reg)
+    { case 4:  RecCvNumber = 29 - 1; break;
+      case 5:  // page register: handled here (once, like SM commands)
+        if (RecRepeat == 2)
+        { if (RecCvOperation == CV_WRITE) {sm_page = RecCvData; activate_ACK(6);}
+          else if (sm_page == RecCvData) activate_ACK(6);
+        }
+        return(IGNORE_CMD);
+      case 6:  RecCvNumber = 7 - 1; break;
+      case 7:  RecCvNumber = 8 - 1; break;
+      default: RecCvNumber = (unsigned char)(sm_page - 1) * 4 + reg; break; // page 0: out of range
+    }
+    return(SM_CMD);
+  }
   return(IGNORE_CMD);
 }
 
@@ -191,11 +329,38 @@ unsigned char analyze_service_mode_message(t_message *new_dcc)
 //***************************************************************************************
 // Broadcast Command for Multi Function Digital Decoders
 //***************************************************************************************
+// The broadcasts in CV SafeMode put the relays in the safe state (see relays.c). This is done
+// here, as soon as the packet is decoded, and not by main after the command is returned
+#define SAFE_ESTOP      0		// Bit 0: broadcast emergency stop
+#define SAFE_STOP       1		// Bit 1: broadcast stop
+#define SAFE_ACCESSORY  2		// Bit 2: basic accessory broadcast (0x1FF), and extended 
+					//        accessory broadcast (0x7FF) with aspect 0 (absolute stop)
+
 unsigned char analyze_broadcast_message(t_message *new_dcc)
-{ if (new_dcc->dcc[1] == 0)
-  { service_mode_state |= (1 << SM_ENABLED);
+{ unsigned char speed;
+  if (new_dcc->dcc[1] == 0)
+  { // reset message - enter service mode. The receiver prefilter is disabled while in 
+    // service mode, so we see all packets and can leave service mode at the first 
+    // packet that is not for service mode
+    if (!(service_mode_state & (1 << SM_ENABLED)) && dcc_filter.enabled)
+      service_mode_state |= (1 << SM_FILTER);
+    service_mode_state |= (1 << SM_ENABLED);
     last_sm_mode_received = timerval;
+    dcc_filter.enabled = 0;
+    return(IGNORE_CMD);
+  }
+  // Broadcast stop. In 14/28 speed step mode the instruction is 01DCSSSS, with SSSS = 0000 for
+  // stop and 0001 for emergency stop (C is the intermediate step or the light). In 128 speed
+  // step mode the speed byte follows 00111111: DSSSSSSS, with stop = 0 and emergency stop = 1
+  if (new_dcc->size == 3) 
+  { speed = new_dcc->dcc[1];
+    if ((speed & 0b11000000) != 0b01000000) return(IGNORE_CMD);
+    speed = speed & 0b00001111;
   }
+  else if ((new_dcc->size == 4) && (new_dcc->dcc[1] == 0b00111111)) speed = new_dcc->dcc[2] & 0b01111111;
+  else return(IGNORE_CMD);
+  if (speed > 1) return(IGNORE_CMD);
+  if (CV_RAM.SafeMode & (1 << (speed ? SAFE_ESTOP : SAFE_STOP))) set_safe_state();
   return(IGNORE_CMD);
 }
 
@@ -225,68 +390,101 @@ unsigned char function_changed(unsigned char mask) {
 }
 
 
+// Support function for F5..F28: a group of functions is received. Like for F1..F4, the 
+// first packet of each group only initialises the group. After that, all functions that 
+// changed are returned at once (in RecFuncBase, RecFuncState and RecFuncChanged)
+#define FUNC_F5_F8            0
+#define FUNC_F9_F12           1
+#define FUNC_F13_F20          2
+#define FUNC_F21_F28          3
+
+unsigned char function_group(unsigned char group, unsigned char base, unsigned char value)
+{ unsigned char changed = value ^ LastRecFunc[group];
+  LastRecFunc[group] = value;
+  if (!(RecFuncKnown & (1 << group))) {		// we are not yet initialised
+    RecFuncKnown |= (1 << group);
+    return(IGNORE_CMD);
+  }
+  if (!changed) return(IGNORE_CMD);		// retransmission
+  RecFuncBase = base;
+  RecFuncState = value;
+  RecFuncChanged = changed;
+  return(LOCO_F5F28_CMD);
+}
+
+
+// Instructions for our own loco address (14 bit My_Loco_Addr, or 7 bit My_Short_Addr)
+// The instruction starts at new_dcc->dcc[i]: i = 1 for 7 bit, i = 2 for 14 bit addresses
+// Of the instructions (see RP921 for more information) we only implement:
+// 100 Function Group One Instruction
+// 101 Function Group Two Instruction
+// 110 Future Expansion: only F13..F20 and F21..F28
+// 111 Configuration Variable Access Instruction
+unsigned char analyze_loc_instruction(t_message *new_dcc, unsigned char i)
+{ if ((new_dcc->dcc[i] & 0b11100000) == 0b10000000) {	// Function Group One (F0..F4)
+    // This is a "trick: to allow setting of switches and relays via loco functions F1..F4
+    // We set a TargetDevice and TargetGate if we discover a new setting of F1..F4
+    // A DCC command may modify multiple functions at once. In that case we only take
+    // the first. Since DCC commands for functions F1..F4 will be retransmitted, we take
+    // the subsequent functions during one of the retransmissions. 
+    // To avoid possible interference between loco functions F1..F4 and accessory commands,
+    // we make no attempt to match the F1..F4 values with the actual "device" settings
+    RecF1_F4 = (new_dcc->dcc[i] & 0b00001111);
+    if (RecF1_F4 == LastRecF1_F4) return(IGNORE_CMD); // retransmission
+    else {
+      if (LastRecF1_F4 == 255) { // we are not yet initialised
+        LastRecF1_F4 = RecF1_F4;
+        return(IGNORE_CMD);
+      }
+      else { // something changed
+        if (function_changed(0b00000001)) return(LOCO_F0F4_CMD);
+        if (function_changed(0b00000010)) return(LOCO_F0F4_CMD);
+        if (function_changed(0b00000100)) return(LOCO_F0F4_CMD);
+        if (function_changed(0b00001000)) return(LOCO_F0F4_CMD);
+        return(IGNORE_CMD); // This return statement should never be executed ...
+      }
+    }
+  }
+  if ((new_dcc->dcc[i] & 0b11100000) == 0b10100000) {	// Function Group Two (F5..F12)
+    // {instruction} = 101SDDDD: S = 1: F5..F8, S = 0: F9..F12
+    if (new_dcc->dcc[i] & 0b00010000) return(function_group(FUNC_F5_F8, 5, new_dcc->dcc[i] & 0b00001111));
+    else return(function_group(FUNC_F9_F12, 9, new_dcc->dcc[i] & 0b00001111));
+  }
+  if (new_dcc->dcc[i] == 0b11011110)			// F13..F20: 11011110 DDDDDDDD
+    return(function_group(FUNC_F13_F20, 13, new_dcc->dcc[i + 1]));
+  if (new_dcc->dcc[i] == 0b11011111)			// F21..F28: 11011111 DDDDDDDD
+    return(function_group(FUNC_F21_F28, 21, new_dcc->dcc[i + 1]));
+  if ((new_dcc->dcc[i] & 0b11100000) == 0b11100000) {	// Configuration Variable Access Instruction
+    // We implement Programming of the Main (PoM), to allow changing of the feedback decoder's CV values
+    // We only implement the long form of CV Access Instructions (see RP9.2.1)
+    // Note that this is the only form of PoM supported by the XPressNet specification
+    // {preamble} 0 10AAAAAA 0 0AAA0AA1 0 (1110CCAA 0 AAAAAAAA 0 DDDDDDDD) 0 EEEEEEEE 1
+    // {preamble} 0 0AAAAAAA 0 (1110CCAA 0 AAAAAAAA 0 DDDDDDDD) 0 EEEEEEEE 1
+    if (!(new_dcc->dcc[i] & 0b00010000)) {			// We only support the long form
+      RecCvOperation = (new_dcc->dcc[i] & 0b00001100);  	// CC bits
+      RecCvOperation = RecCvOperation >> 2;
+      RecCvNumber = ((new_dcc->dcc[i] & 0b00000011) << 8) | new_dcc->dcc[i + 1];
+      RecCvData = new_dcc->dcc[i + 2];
+      return(POM_CMD);
+    }
+  }
+  return(IGNORE_CMD);
+}
+
+
 unsigned char analyze_loc_7bit_message(t_message *new_dcc)
-{ // {preamble} 0 0AAAAAAA 0 01DCSSSS 0 EEEEEEEE 1
-  // C may be lsb of speed or headlight
-  // D = direction: 1 = forward
+{ // {preamble} 0 0AAAAAAA 0 {instruction bytes} 0 EEEEEEEE 1
   RecLocoAddr = (new_dcc->dcc[0] & 0b01111111);
-  // see RP921 for more information
-  switch (new_dcc->dcc[1] & 0b11100000)
-  { case 0b00000000: break;           // 000 Decoder and Consist Control Instruction
-    case 0b00100000: break;           // 001 Advanced Operation Instructions
-    case 0b01000000: break;           // 010 Speed and Direction Instruction for reverse operation
-    case 0b01100000: break;           // 011 Speed and Direction Instruction for forward operation
-    case 0b10000000: break;           // 100 Function Group One Instruction
-    case 0b10100000: break;           // 101 Function Group Two Instruction
-    case 0b11000000: break;           // 110 Future Expansion
-    case 0b11100000: break;           // 111 Configuration Variable Access Instruction
-  }
+  if (My_Short_Addr && (RecLocoAddr == My_Short_Addr)) return(analyze_loc_instruction(new_dcc, 1));
   return(IGNORE_CMD);
 }
 
 
 unsigned char analyze_loc_14bit_message(t_message *new_dcc)
 { // Multi-Function (LOCO) decoders with 14 bit addresses
+  // {preamble} 0 11AAAAAA 0 AAAAAAAA 0 {instruction bytes} 0 EEEEEEEE 1
   RecLocoAddr = ((new_dcc->dcc[0] & 0b00111111) << 8) | (new_dcc->dcc[1]);
-  if (RecLocoAddr == My_Loco_Addr) {
-    if ((new_dcc->dcc[2] & 0b11100000) == 0b10000000) {	// Function Group One (F0..F4)
-      // This is a "trick: to allow setting of switches and relays via loco functions F1..F4
-      // We set a TargetDevice and TargetGate if we discover a new setting of F1..F4
-      // A DCC command may modify multiple functions at once. In that case we only take
-      // the first. Since DCC commands for functions F1..F4 will be retransmitted, we take
-      // the subsequent functions during one of the retransmissions. 
-      // To avoid possible interference between loco functions F1..F4 and accessory commands,
-      // we make no attempt to match the F1..F4 values with the actual "device" settings
-      RecF1_F4 = (new_dcc->dcc[2] & 0b00001111);
-      if (RecF1_F4 == LastRecF1_F4) return(IGNORE_CMD); // retransmission
-      else {
-        if (LastRecF1_F4 == 255) { // we are not yet initialised
-          LastRecF1_F4 = RecF1_F4;
-          return(IGNORE_CMD);
-        }
-        else { // something changed
-          if (function_changed(0b00000001)) return(LOCO_F0F4_CMD);
-          if (function_changed(0b00000010)) return(LOCO_F0F4_CMD);
-          if (function_changed(0b00000100)) return(LOCO_F0F4_CMD);
-          if (function_changed(0b00001000)) return(LOCO_F0F4_CMD);
-          return(IGNORE_CMD); // This return statement should never be executed ...
-        }
-      }
-    }
-    if ((new_dcc->dcc[2] & 0b11100000) == 0b11100000) {	// Configuration Variable Access Instruction
-      // We implement Programming of the Main (PoM), to allow changing of the feedback decoder's CV values
-      // We only implement the long form of CV Access Instructions (see RP9.2.1)
-      // Note that this is the only form of PoM supported by the XPressNet specification
-      // {preamble} 0 10AAAAAA 0 0AAA0AA1 0 (1110CCAA 0 AAAAAAAA 0 DDDDDDDD) 0 EEEEEEEE 1
-      if (!(new_dcc->dcc[2] & 0b00010000)) {			// We only support the long form
-        RecCvOperation = (new_dcc->dcc[2] & 0b00001100);  	// CC bits
-        RecCvOperation = RecCvOperation >> 2;
-        RecCvNumber = ((new_dcc->dcc[2] & 0b00000011) << 8) | new_dcc->dcc[3];
-        RecCvData = new_dcc->dcc[4];
-        return(POM_CMD);
-      }
-    }
-  }
+  if (RecLocoAddr == My_Loco_Addr) return(analyze_loc_instruction(new_dcc, 2));
   return(IGNORE_CMD);
 }
 
@@ -294,9 +492,9 @@ unsigned char analyze_loc_14bit_message(t_message *new_dcc)
 //***************************************************************************************
 // Basic Accessory (9 bit addresses) and Extended Accessory (11 bit addresses) Decoders 
 //***************************************************************************************
-unsigned char analyze_basic_accessory_message(t_message *new_dcc)
+unsigned char analyze_accessory_message(t_message *new_dcc)
 { unsigned int GlobalPortAddr;  // Similar to switch address on the LH100, but starts at 0 
-  unsigned char MaskedPort;	// In case of SkipUnEven, the even and uneven port are merged
+  unsigned char i;
   if ((new_dcc->dcc[1] >= 0b10000000) && (MyConfig == 0))
   { // BASIC ACCESSORY DECODER (with 9 bit addressing)
     // Note: this is the only form supported by the XPRESSNET specification and LENZ
@@ -304,8 +502,14 @@ unsigned char analyze_basic_accessory_message(t_message *new_dcc)
     // - RecDecAddr, RecDecPort, TargetGate and TargetActivate 
     // Step 1A: Determine the address received
     // take bits 5 4 3 2 1 0 from new_dcc->dcc[0]
-    // take Bits 6 5 4 from new_dcc->dcc[1] and invert
+    // take Bits 6 5 4 from new_dcc->dcc[1] and invert (these are address bits 10 9 8)
     RecDecAddr = (new_dcc->dcc[0] & 0b00111111) | ((~new_dcc->dcc[1] & 0b01110000) << 2);
+    // The broadcast address is 0x01FF on the wire, also for LENZ. It addresses all outputs of
+    // all decoders, so there is no TargetDevice; it can only put the relays in the safe state 
+    if (RecDecAddr == 0x01FF)
+    { if ((new_dcc->size == 3) && (CV_RAM.SafeMode & (1 << SAFE_ACCESSORY))) set_safe_state();
+      return(IGNORE_CMD);
+    }
     // Step 1B: Correct the received address in case it was generated by a LENZ central station
     // In general, LENZ starts with 1, instead of 0. 
     // Further, if the received address is exactly 0, 64, 128 or 192, the address is 64 to low.
@@ -313,13 +517,7 @@ unsigned char analyze_basic_accessory_message(t_message *new_dcc)
     // Usage of this compensation is needed in case the decoder uses more than one 
     // (consecutive) address (such as the case if we skip even addresses), 
     // or provides RS-bus feedback.
-    if ((my_eeprom_read_byte(&CV.CmdStation)) == 1) // Lenz system
-    { if (RecDecAddr == 0) {RecDecAddr = 64;}
-      else if (RecDecAddr == 64) {RecDecAddr = 128;}
-      else if (RecDecAddr == 128) {RecDecAddr = 192;}
-      else if (RecDecAddr == 192) {RecDecAddr = 256;}
-      RecDecAddr --;
-    }
+    if (LenzCorrection) RecDecAddr = dcc_lenz_correction(RecDecAddr);   // Lenz system, see dcc_receiver.h
     // Step 2: Determine which port (often a switch or relays) is contained within this DCC command
     // The received command suppports a range from 0..3 (thus in general 4 switches)
     // Note that the RecDecPort is NOT the same as the TargetDevice
@@ -338,22 +536,19 @@ unsigned char analyze_basic_accessory_message(t_message *new_dcc)
       // {preamble} 0 10AAAAAA 0 1AAACDDD 0 EEEEEEEE 1
       //                AAAAAA    aaa                   = Decoder Address
       // Determine the received "global" port address (=switch address on LH100 - 1)       
-      GlobalPortAddr = (RecDecAddr * 4) + RecDecPort;
-      // We will calculate the TargetDevice, which may be used by the remainder of the code
-      // The TargetDevice will in many cases by equivalent to the RecDecPort, except:
-      // - if SkipUnEven is set
-      // - the received addrress is higher than my accessory decoder's address (= we support more addresses)
-      if ((my_eeprom_read_byte(&CV.SkipUnEven)) == 1) {
-        MaskedPort = ((RecDecPort & 0b00000010) >> 1);
-        if (RecDecAddr >= My_Dec_Addr) {TargetDevice = (RecDecAddr - My_Dec_Addr) * 2 + MaskedPort;}
-      }
-      else {
-        if (RecDecAddr >= My_Dec_Addr) {TargetDevice = (RecDecAddr - My_Dec_Addr) * 4 + RecDecPort;}
-      }
-      // Return to the calling routine the kind of command
-      if (RecDecAddr == 0x01FF) {return(ACCESSORY_CMD);} // broadcast
-      if ((GlobalPortAddr >= MyFirstAdrPlusCoil) && (GlobalPortAddr <= MyLastAdrPlusCoil)) return(ACCESSORY_CMD);
-        else return(ANY_ACCESSORY_CMD);
+      GlobalPortAddr = (RecDecAddr << 2) | RecDecPort;
+      // Check the address windows (a fixed number of compares). Within a window, we calculate
+      // the TargetDevice, which may be used by the remainder of the code. The TargetDevice will 
+      // in many cases by equivalent to the RecDecPort, except:
+      // - if SkipUnEven is set: the even and uneven port are merged (TargetShift = 1)
+      // - the received addrress is higher than the first address of the window (= we support more addresses)
+      // - the window starts at another device (windows 1..3)
+      for (i = 0; i < ACC_WINDOWS; i++)
+        if ((GlobalPortAddr >= dcc_filter.acc[i].first) && (GlobalPortAddr <= dcc_filter.acc[i].last))
+        { TargetDevice = dcc_filter.acc[i].device + ((GlobalPortAddr - dcc_filter.acc[i].first) >> TargetShift);
+          return(ACCESSORY_CMD);
+        }
+      return(ANY_ACCESSORY_CMD);
     }
     else if (new_dcc->size == 6) // cv-access on the main of accessory decoder
     { // Note: this command is not supported by LENZ / Expressnet
@@ -375,17 +570,20 @@ unsigned char analyze_basic_accessory_message(t_message *new_dcc)
     // Code could therefore not be tested.
     // take bits 2 1 from new_dcc->dcc[1]
     // take bits 5 4 3 2 1 0 from new_dcc->dcc[0]
-    // take Bits 6 5 4 from new_dcc->dcc[1] and invert
+    // take Bits 6 5 4 from new_dcc->dcc[1] and invert (these are address bits 10 9 8)
     RecDecAddr = (( new_dcc->dcc[1] & 0b00000110) >> 1)
                | (( new_dcc->dcc[0] & 0b00111111) << 2)
-               | ((~new_dcc->dcc[1] & 0b01110000) >> 4);
+               | ((~new_dcc->dcc[1] & 0b01110000) << 4);
     if (new_dcc->size == 4) // it's a command
     { // Format:
       // {preamble} 0 10AAAAAA 0 0AAA0AA1 0 000XXXXX 0 EEEEEEEE 1
       // {preamble} 0 10111111 0 00000111 0 000XXXXX 0 EEEEEEEE 1
       // output mode
       RecDecPort = new_dcc->dcc[2] & 0b00011111;  // aspect
-      if (RecDecAddr == 0x07FF) {return(ACCESSORY_CMD);} // broadcast
+      if (RecDecAddr == 0x07FF) // broadcast; aspect 0 is the absolute stop aspect
+      { if ((RecDecPort == 0) && (CV_RAM.SafeMode & (1 << SAFE_ACCESSORY))) {set_safe_state(); return(IGNORE_CMD);}
+        return(ACCESSORY_CMD);
+      }
       if (RecDecAddr == My_Dec_Addr) return(ACCESSORY_CMD);
       else return(ANY_ACCESSORY_CMD);
     }
@@ -414,44 +612,85 @@ unsigned char analyze_basic_accessory_message(t_message *new_dcc)
 // Sets various variable as "side effect": see global.h for details
 
 void analyze_message(t_message *new_dcc)
-{ unsigned char i;
-  unsigned char myxor = 0;
-  // Reset global variables
+{ // Reset global variables
   CmdType = IGNORE_CMD;
-  // Check if the DCC packet has a correct checksum. If error, ignore everything and return)
-  for (i=0; i<new_dcc->size; i++) myxor = myxor ^ new_dcc->dcc[i];
-  if (myxor)
-  { // checksum error, ignore remainder of message
-    DccSignalQuality ++;
-    return;
-  }
+  // The checksum has already been verified by the dcc_receiver
+  RecRepeat = repeat_count(new_dcc);
   // Handle the case we are in service mode (programming on the programming track)
-  if (service_mode_state & (1 << SM_ENABLED)) analyze_service_mode_message(new_dcc);
-  service_mode_state = 0;              // anyway  
+  // If the packet is not for service mode, service mode ends and the packet is decoded
+  // as a normal DCC packet
+  if (service_mode_state & (1 << SM_ENABLED))
+    CmdType = analyze_service_mode_message(new_dcc);
   // We are decoding a normal DCC packet - See for steps RP 9.2.1
-  if      (new_dcc->dcc[0] == 0  ) CmdType = analyze_broadcast_message(new_dcc);
-  else if (new_dcc->dcc[0] <= 127) CmdType = analyze_loc_7bit_message(new_dcc);
-  else if (new_dcc->dcc[0] <= 191) CmdType = analyze_basic_accessory_message(new_dcc); 
-  else if (new_dcc->dcc[0] <= 231) CmdType = analyze_loc_14bit_message(new_dcc);
-  else if (new_dcc->dcc[0] <= 254) {}  // Reserved in DCC for Future Use
-  else {;}                             // Idle Packet
+  if (!(service_mode_state & (1 << SM_ENABLED)))
+  { switch (pgm_read_byte(&dcc_class[new_dcc->dcc[0]]))
+    { case CLASS_BROADCAST:  CmdType = analyze_broadcast_message(new_dcc); break;
+      case CLASS_LOCO_7BIT:  CmdType = analyze_loc_7bit_message(new_dcc); break;
+      case CLASS_ACCESSORY:  CmdType = analyze_accessory_message(new_dcc); break;
+      case CLASS_LOCO_14BIT: CmdType = analyze_loc_14bit_message(new_dcc); break;
+      default:               break;  // Reserved in DCC for Future Use, and Idle Packet
+    }
+  }
+  // Apply the policy for repeated packets:
+  // - Accessory commands: only the first occurrence
+  // - F0..F4: all occurrences, since function_changed() takes one function per packet
+  // - PoM and SM: only the second occurrence (as required by the NMRA)
+  switch (CmdType)
+  { case ANY_ACCESSORY_CMD:
+    case ACCESSORY_CMD: if (RecRepeat != 1) CmdType = IGNORE_CMD; break;
+    case POM_CMD:
+    case SM_CMD:        if (RecRepeat != 2) CmdType = IGNORE_CMD; break;
+    default:            break;
+  }
 }
 
 
 //***************************************************************************************
 // Initialization -  must be called once at power up
 //***************************************************************************************
+// Set accessory window k to ports port addresses from decoder address dec_addr on, mapped
+// onto the devices from device on. The window is limited to the last device
+void init_acc_window(unsigned char k, unsigned int dec_addr, unsigned char device, unsigned char ports)
+{ t_acc_window *window = &dcc_filter.acc[k];
+  unsigned char max_ports;
+  if ((dec_addr > 511) || (device >= NUMBER_OF_DEVICES) || (ports == 0)) {
+    window->first = 0xFFFF;	// not used
+    window->last = 0;
+    return;
+  }
+  max_ports = (NUMBER_OF_DEVICES - device) << TargetShift;
+  if (ports > max_ports) ports = max_ports;
+  window->first  = dec_addr * 4;
+  window->last   = dec_addr * 4 + ports - 1;
+  window->device = device;
+}
+
 void init_dcc_decode(void)
-{ 
-  DccSignalQuality = 0;		// Counter for DCC errors
+{ unsigned char i;
   service_mode_state = 0;	// all bits off
+  sm_page = 1;			// NMRA: page register is 1 after power up
   LastRecF1_F4 = 255;		// status of F0..F4 (= value last command)
-  if ((my_eeprom_read_byte(&CV.SkipUnEven)) == 1) {
-    MyFirstAdrPlusCoil = (My_Dec_Addr * 4);
-    MyLastAdrPlusCoil  = (My_Dec_Addr * 4) + (NUMBER_OF_DEVICES - 1) * 2 + 1;}
-  else {
-    MyFirstAdrPlusCoil = My_Dec_Addr * 4;
-    MyLastAdrPlusCoil  = My_Dec_Addr * 4 + NUMBER_OF_DEVICES - 1;}
+  RecFuncKnown = 0;		// status of F5..F28 not yet known
+  for (i = 0; i < REPEAT_CACHE_SIZE; i++) repeat_cache[i].msg.size = 0;
+  RepeatWindow = my_eeprom_read_byte(&CV.RepeatWin);
+  if (RepeatWindow > 127) RepeatWindow = 127;
+  LenzCorrection = (my_eeprom_read_byte(&CV.CmdStation) == 1);
+  TargetShift = (my_eeprom_read_byte(&CV.SkipUnEven) == 1);
+  // Window 0: all devices, from My_Dec_Addr on (two decoder addresses if SkipUnEven)
+  init_acc_window(0, My_Dec_Addr, 0, NUMBER_OF_DEVICES << TargetShift);
+  // Windows 1..3: from CV110..CV121
+  for (i = 1; i < ACC_WINDOWS; i++) {
+    t_cv_window *cv = &CV_RAM.Window[i - 1];
+    if ((cv->AddrH & 0x80) || (cv->AddrL > 63)) init_acc_window(i, INVALID_DEC_ADR, 0, 0);
+    else init_acc_window(i, ((cv->AddrH & 0x07) << 6) + cv->AddrL - 1, cv->Device - 1, cv->Ports);
+  }
+  // Parameters for the address prefilter of the dcc_receiver (which shares the windows)
+  dcc_filter.extended  = (MyConfig != 0);
+  dcc_filter.lenz      = LenzCorrection;
+  dcc_filter.dec_addr  = My_Dec_Addr;
+  dcc_filter.loco_addr = My_Loco_Addr;
+  dcc_filter.short_addr = My_Short_Addr;
+  dcc_filter.enabled   = 1;
 }
 
 
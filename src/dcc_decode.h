@@ -16,5 +16,8 @@
 //*****************************************************************************************************
 void init_dcc_decode(void);
 void analyze_message(t_message *new);       // Sets the global CmdType variable plus possible others 
+void check_repeat_time_out(void);           // Must be called every 20ms
+void check_service_mode_time_out(void);     // Must be called every 20ms
+void restart_after_service_mode(void);      // Restart when service mode ends (after SM CV writes)
 
 #endif
@@ -39,6 +39,18 @@
 //                               Removed some generic OPENDECODER code not being used
 //            2013-02-24 V0.9 ap Rewrote some parts to make this file applicable for all versions
 //				 of Opendecoder V2.2 (GBM specific parts "isolated" in #if statements
+//            2026-10-16 V0.A    Single "incoming" buffer replaced by a ring buffer of
+//                               DCC_RING_SIZE messages, so that no messages get lost
+//                               while main is busy (RS-bus, ACK, LCD, EEPROM)
+//                               Added edge capture receiver, selected by DCC_RECEIVER_MODE
+//                               The message is received directly in its ring slot;
+//                               the copy from "local" at the end of a message is gone
+//                               Checksum and framing are checked while receiving
+//                               Address prefilter: messages not for us are dropped
+//                               16 bit error counters and windowed statistics
+//                               Adaptive sample point (sampling mode)
+//                               RailCom cutout measurement if CV BiDi is set
+//                               DCC presence monitor (100ms windows)
 //
 //------------------------------------------------------------------------
 //
@@ -63,6 +75,8 @@
 //      Timer0: for T77us Delay 
 //      Overflow Interrupt Timer0: (evaluating DCCIN Level)
 //      DCC_ACK (for acknowledge)
+//      With DCC_RECEIVER_MODE == DCC_RX_EDGE_CAPTURE, Timer0 is not used;
+//      INT1 triggers on both edges and reads the Timer1 counter instead.
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -74,6 +88,7 @@
 #include <string.h>
 
 #include "config.h"
+#include "myeeprom.h"            // wrapper for eeprom (CV BiDi)
 #include "hardware.h"            // Port and CPU definitions
 #include "dcc_receiver.h"
 
@@ -87,11 +102,13 @@
   #define DCC_Interrupt_Port					INT1
   #define DCC_Interrupt_Sense_Control_Bit_0			ISC10		// Bit setting
   #define DCC_Interrupt_Sense_Control_Bit_1			ISC11		// Bit setting
+  #define DCC_Interrupt_Flag					INTF1		// Bit setting
 #else
   #define DCC_Interrupt_Vector					INT0_vect	// We use Interrupt 0
   #define DCC_Interrupt_Port					INT0
   #define DCC_Interrupt_Sense_Control_Bit_0			ISC00		// Bit setting
   #define DCC_Interrupt_Sense_Control_Bit_1			ISC01		// Bit setting
+  #define DCC_Interrupt_Flag					INTF0		// Bit setting
 #endif
 
 
@@ -99,9 +116,11 @@
 #if defined ENHANCED_PROCESSOR
   #define Interrupt_Select_Register				EIMSK    	// External Interrupt Mask Register
   #define Interrupt_Control_Register				EICRA   	// External Interrupt Control Register
+  #define Interrupt_Flag_Register				EIFR    	// External Interrupt Flag Register
 #else 
   #define Interrupt_Select_Register				GICR    	// General Interrupt Control Register
   #define Interrupt_Control_Register				MCUCR   	// MCU Control Register
+  #define Interrupt_Flag_Register				GIFR    	// General Interrupt Flag Register
 #endif
 
 // Timer 0 specific settings
@@ -141,6 +160,394 @@ void activate_ACK(unsigned char time)
 
 
 
+//---------------------------------------------------------------------------
+// Ring buffer between the ISR (single producer) and main (single consumer).
+// Only the ISR writes dcc_ring_head, only main writes dcc_ring_tail. Both are
+// single bytes, so reading and writing them is atomic and no locking is needed.
+// One slot is always kept free, to distinguish a full ring from an empty ring.
+// The number of slots depends on the available SRAM (see hardware.h).
+#if (SRAM_SIZE <= 512)
+  #define DCC_RING_SIZE   4
+#elif (SRAM_SIZE <= 1024)
+  #define DCC_RING_SIZE   8
+#else
+  #define DCC_RING_SIZE   16
+#endif
+#define DCC_RING_MASK     (DCC_RING_SIZE - 1)
+#if (DCC_RING_SIZE & DCC_RING_MASK)
+  #error DCC_RING_SIZE must be a power of two
+#endif
+
+t_message dcc_ring[DCC_RING_SIZE];
+volatile unsigned char dcc_ring_head;           // next slot the ISR will fill
+volatile unsigned char dcc_ring_tail;           // oldest slot main has not yet handled
+volatile unsigned int dcc_ring_overflows;       // saturates at 0xFFFF
+
+// Messages with errors are discarded by the ISR and never reach the ring.
+volatile t_dcc_errors dcc_errors;               // each counter saturates at 0xFFFF
+volatile unsigned int dcc_valid;
+volatile unsigned int dcc_idle;
+
+// Address prefilter; the parameters are set by init_dcc_decode().
+t_dcc_filter dcc_filter;
+volatile unsigned int dcc_accepted;             // both counters wrap around
+volatile unsigned int dcc_filtered;
+
+
+t_message *dcc_peek_message(void)
+  {
+    if (dcc_ring_tail == dcc_ring_head) return(0);
+    return(&dcc_ring[dcc_ring_tail]);
+  }
+
+
+void dcc_release_message(void)
+  {
+    dcc_ring_tail = (dcc_ring_tail + 1) & DCC_RING_MASK;
+  }
+
+
+//---------------------------------------------------------------------------
+// Statistics. The ISR only increments counters; the rates are calculated
+// here, in the 20ms tick of main.
+#define STAT_WINDOW       50                    // ticks of 20ms = 1 second
+
+t_dcc_statistics dcc_statistics;
+t_dcc_presence dcc_presence;
+volatile unsigned char dcc_bits;                // received bits, wraps around (see below)
+unsigned int  stat_prev_valid;                  // dcc_valid at the previous tick
+unsigned int  stat_prev_idle;                   // dcc_idle at the previous tick
+unsigned int  stat_window_valid;                // counts within the current window
+unsigned int  stat_window_idle;
+unsigned char stat_ticks;
+
+// Presence monitor. dcc_bits is 8 bit, to keep the ISR short: within one tick of
+// 20ms at most 20000 / 116 = 172 bits can be received, so the difference between
+// two ticks never wraps. 
+#define PRESENCE_WINDOW       5                 // ticks of 20ms = 100ms
+#define PRESENCE_MIN_PACKETS  2                 // valid packets for a good window
+#define PRESENCE_RECOVER      2                 // good windows before the signal is back
+
+unsigned char pres_prev_bits;                   // dcc_bits at the previous tick
+unsigned int  pres_window_valid;                // counts within the current window
+unsigned int  pres_window_bits;
+unsigned char pres_ticks;
+unsigned char pres_good;                        // successive good windows, up to PRESENCE_RECOVER
+
+
+unsigned int dcc_read_counter(volatile unsigned int *counter)
+  {                                             // the ISR may change the counter
+    unsigned int value;                         // between reading the two bytes
+    cli();
+    value = *counter;
+    sei();
+    return(value);
+  }
+
+
+void dcc_statistics_tick(void)
+  {
+    unsigned int valid = dcc_read_counter(&dcc_valid);
+    unsigned int idle  = dcc_read_counter(&dcc_idle);
+    unsigned int delta = valid - stat_prev_valid;
+    unsigned char bits;
+
+    stat_window_valid += delta;
+    stat_window_idle  += idle - stat_prev_idle;
+    stat_prev_valid = valid;
+    stat_prev_idle  = idle;
+
+    if (delta) dcc_statistics.since_valid = 0;
+    else if (dcc_statistics.since_valid != 0xFFFF)
+      {
+        dcc_statistics.since_valid++;
+        if (dcc_statistics.since_valid > dcc_statistics.longest_gap)
+          dcc_statistics.longest_gap = dcc_statistics.since_valid;
+      }
+
+    if (++stat_ticks == STAT_WINDOW)
+      {                                         // at most ~400 packets/s, so no overflow
+        dcc_statistics.packets = stat_window_valid;
+        if (stat_window_valid)
+          dcc_statistics.idle_percent = (stat_window_idle * 100UL) / stat_window_valid;
+        else
+          dcc_statistics.idle_percent = 0;
+        stat_window_valid = 0;
+        stat_window_idle = 0;
+        stat_ticks = 0;
+      }
+
+    // The presence monitor: the signal is lost after one window without enough 
+    // valid packets, and back after PRESENCE_RECOVER good windows in a row
+    bits = dcc_bits;
+    pres_window_valid += delta;
+    pres_window_bits += (unsigned char)(bits - pres_prev_bits);
+    pres_prev_bits = bits;
+    if (++pres_ticks == PRESENCE_WINDOW)
+      {
+        dcc_presence.packets = pres_window_valid;
+        dcc_presence.bits = pres_window_bits;
+        if (pres_window_valid >= PRESENCE_MIN_PACKETS)
+          {
+            if (pres_good < PRESENCE_RECOVER) pres_good++;
+          }
+        else pres_good = 0;
+        if (dcc_presence.present && !pres_good)
+          {
+            dcc_presence.present = 0;
+            if (dcc_presence.losses != 0xFFFF) dcc_presence.losses++;
+          }
+        else if (!dcc_presence.present && (pres_good == PRESENCE_RECOVER))
+          dcc_presence.present = 1;
+        pres_window_valid = 0;
+        pres_window_bits = 0;
+        pres_ticks = 0;
+      }
+  }
+
+
+void dcc_statistics_reset(void)
+  {
+    cli();
+    dcc_ring_overflows = 0;
+    dcc_errors.checksum = 0;
+    dcc_errors.too_long = 0;
+    dcc_errors.framing = 0;
+    dcc_errors.preamble = 0;
+    dcc_cutout.detected = 0;
+    dcc_cutout.compliant = 0;
+    dcc_cutout.missing = 0;
+    sei();
+    dcc_statistics.longest_gap = 0;
+    dcc_presence.losses = 0;
+  }
+
+
+//---------------------------------------------------------------------------
+// Timing of the DCC signal. Timer1 is the free running 20ms tick timer (see
+// timer1.c); it runs with prescaler 8 and is used to timestamp the edges.
+#define T1_TICKS_PER_MS     (F_CPU / 8 / 1000L)
+#define US2T1(us)           ((us) * T1_TICKS_PER_MS / 1000L)
+#define T12US(ticks)        ((ticks) * 1000UL / T1_TICKS_PER_MS)
+
+unsigned int  dcc_last_edge;                    // Timer1 value at the previous edge
+t_dcc_timing  dcc_timing;
+
+
+// Timer1 ticks from "from" to "to". Timer1 counts from 0 to ICR1 (fast PWM,
+// mode 14) and then wraps to 0.
+static inline unsigned int t1_ticks_between(unsigned int from, unsigned int to) __attribute__((always_inline));
+unsigned int t1_ticks_between(unsigned int from, unsigned int to)
+  {
+    if (to >= from) return(to - from);
+    return(to + ICR1 + 1 - from);
+  }
+
+//---------------------------------------------------------------------------
+// RailCom cutout (NMRA S-9.3.2). If CV BiDi is not 0, the receiver looks for
+// the cutout after every packet end bit. Relative to the end of the end bit,
+// the cutout should start (TCS) after 26..32us and end (TCE) after 454..488us.
+// During the cutout the rails are shorted, no current flows through the
+// opto-coupler and DCCIN is high, just as during a half-bit in which K is
+// positive. Therefore what can be measured depends on how J and K are wired:
+// - If the half-bit after the end bit has DCCIN high, the start of the cutout
+//   cannot be seen (start = 0); DCCIN stays high until the first half of the
+//   bit after the cutout ends, so TCE = end of the high period - half a 1 bit.
+// - Otherwise DCCIN goes high at TCS, and goes low again at TCE.
+// A high period of 250..1000us counts as a cutout, anything shorter or longer
+// as a missing cutout. The sampling receiver switches INT1 to both edges for
+// the duration of the measurement; the preamble bits during the cutout are not
+// sampled (they would be zeros anyway, and would restart the preamble).
+// If BiDi is 0, the only overhead is one flag test per edge and per packet.
+#define CUTOUT_OFF          0
+#define CUTOUT_ARMED        1                   // sampling: wait for the first rising edge
+#define CUTOUT_LOW          2                   // DCCIN low: wait for the start of the cutout
+#define CUTOUT_HIGH         3                   // DCCIN high: wait for the end of the cutout
+
+#define HALF1_NOMINAL       US2T1(58L)
+#define CUTOUT_START_MAX    US2T1(45L)          // a later rising edge is a normal half-bit
+#define CUTOUT_MIN          US2T1(250L)
+#define CUTOUT_MAX          US2T1(1000L)
+#define TCS_MIN             US2T1(26L)
+#define TCS_MAX             US2T1(32L)
+#define TCE_MIN             US2T1(454L)
+#define TCE_MAX             US2T1(488L)
+
+unsigned char dcc_bidi;                         // CV BiDi != 0: measure the cutout
+volatile t_dcc_cutout dcc_cutout;
+unsigned char cutout_state;
+unsigned int  cutout_ref;                       // Timer1 value at the reference edge
+unsigned int  cutout_bias;                      // ticks from the reference to the end of the end bit
+unsigned int  cutout_start;                     // ticks from the end bit to the start (0: not seen)
+volatile unsigned int  cutout_start_ticks;      // last cutout, converted by dcc_timing_tick()
+volatile unsigned int  cutout_end_ticks;
+volatile unsigned char cutout_new;
+
+
+// Called by the state machine after the end bit, if dcc_bidi is set
+static inline void cutout_arm(void) __attribute__((always_inline));
+void cutout_arm(void)
+  {
+    cutout_ref = dcc_last_edge;
+    cutout_bias = 0;
+    cutout_start = 0;
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+    // dcc_last_edge is the rising edge at the start of the end bit. Whether the
+    // end bit ends half a bit or a full bit later depends on the wiring, and
+    // follows from the time of the next rising edge.
+    cutout_state = CUTOUT_ARMED;
+    Interrupt_Control_Register &= ~(1<<DCC_Interrupt_Sense_Control_Bit_1);   // both edges
+    Interrupt_Flag_Register = (1<<DCC_Interrupt_Flag);   // may be set by the change above
+#else
+    // dcc_last_edge is the edge that ended the end bit
+    if (DCCIN_STATE) cutout_state = CUTOUT_HIGH;
+    else cutout_state = CUTOUT_LOW;
+#endif
+  }
+
+
+static inline void cutout_done(void) __attribute__((always_inline));
+void cutout_done(void)
+  {
+    cutout_state = CUTOUT_OFF;
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+    Interrupt_Control_Register |= (1<<DCC_Interrupt_Sense_Control_Bit_1);    // rising edge only
+    Interrupt_Flag_Register = (1<<DCC_Interrupt_Flag);
+#endif
+  }
+
+
+// Called by ISR(INT1) instead of the receiver, as long as cutout_state is set
+static inline void cutout_edge(unsigned int now) __attribute__((always_inline));
+void cutout_edge(unsigned int now)
+  {
+    unsigned int t = t1_ticks_between(cutout_ref, now);
+    unsigned int end;
+
+    if (cutout_state == CUTOUT_ARMED)
+      {                                         // (sampling) first edge must be rising
+        if (!DCCIN_STATE) return;
+        if (t >= US2T1(100L))
+          {                                     // a full bit: this edge ends the end bit
+            cutout_ref = now;                   // and DCCIN stays high (start not visible)
+            cutout_state = CUTOUT_HIGH;
+            return;
+          }
+        cutout_bias = HALF1_NOMINAL;            // the end bit ended half a bit after its
+        cutout_state = CUTOUT_LOW;              // rising edge, DCCIN was low since then
+      }
+    if (t < cutout_bias) t = cutout_bias;
+    t = t - cutout_bias;                        // ticks since the end of the end bit
+
+    if (cutout_state == CUTOUT_LOW)
+      {
+        if (DCCIN_STATE && (t <= CUTOUT_START_MAX))
+          {                                     // the cutout starts
+            cutout_start = t;
+            cutout_state = CUTOUT_HIGH;
+            return;
+          }
+      }
+    else if (!DCCIN_STATE)
+      {                                         // CUTOUT_HIGH: DCCIN low again
+        if ((t - cutout_start >= CUTOUT_MIN) && (t - cutout_start <= CUTOUT_MAX))
+          {
+            if (cutout_start) end = t;
+            else end = t - HALF1_NOMINAL;
+            if (dcc_cutout.detected != 0xFFFF) dcc_cutout.detected++;
+            if ((end >= TCE_MIN) && (end <= TCE_MAX) && 
+               ((cutout_start == 0) || ((cutout_start >= TCS_MIN) && (cutout_start <= TCS_MAX))))
+              {
+                if (dcc_cutout.compliant != 0xFFFF) dcc_cutout.compliant++;
+              }
+            cutout_start_ticks = cutout_start;
+            cutout_end_ticks = end;
+            cutout_new = 1;
+            cutout_done();
+            return;
+          }
+      }
+    else return;                                // CUTOUT_HIGH: ignore a rising edge
+    if (dcc_cutout.missing != 0xFFFF) dcc_cutout.missing++;
+    cutout_done();
+  }
+
+
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+// Adaptive sample point. INT1 measures the period between two rising edges,
+// which is twice the half-bit for symmetric bits. The value of the bit that
+// ended (sampled by Timer0) tells if it was the period of a 1 or of a 0.
+// With J and K swapped the rising edge is in the middle of a bit, and a period
+// spans the second half of one bit and the first half of the next, which is
+// only sampled at the end of the period. So a period is held until the next
+// rising edge and only used when the bits on both sides have the same value
+// (with normal wiring this only skips the last bit of a run). Both are
+// averaged (exponential, weight 1/16) within ranges that exclude noise and
+// stretched zeros. Every tick the sample point is moved to the
+// midpoint between the measured half-bits, within SAMPLE_MIN .. SAMPLE_MAX.
+#define PERIOD1_MIN         US2T1(80L)
+#define PERIOD1_MAX         US2T1(140L)
+#define PERIOD0_MIN         US2T1(140L)
+#define PERIOD0_MAX         US2T1(240L)
+#define SAMPLE_MIN          US2T1(66L)          // above the longest half of a 1 (64us)
+#define SAMPLE_MAX          US2T1(90L)          // the shortest half of a 0
+#define ADAPT_MIN_PERIODS   16                  // per tick, of both kinds
+
+volatile unsigned char dcc_t0_reload;           // Timer0 start value: 256 - sample delay
+volatile unsigned int  dcc_period1_avg16;       // 16 x average period of a 1 (Timer1 ticks)
+volatile unsigned int  dcc_period0_avg16;       // 16 x average period of a 0 (Timer1 ticks)
+volatile unsigned char dcc_period1_n;           // periods measured since the last tick
+volatile unsigned char dcc_period0_n;           // (saturate at 255)
+unsigned int  dcc_period_held;                  // period up to the previous rising edge
+volatile unsigned char dcc_sampled_bits;        // the last sampled bits, the newest in bit 0
+#endif
+
+
+void dcc_timing_tick(void)
+  {
+    if (cutout_new)
+      {                                         // convert the last cutout to us here,
+        unsigned int start, end;                // since divisions are too slow for the ISR
+        cli();
+        start = cutout_start_ticks;
+        end = cutout_end_ticks;
+        cutout_new = 0;
+        sei();
+        dcc_cutout.start = T12US(start);
+        dcc_cutout.end = T12US(end);
+        if (start) dcc_cutout.length = T12US(end - start);
+        else dcc_cutout.length = 0;
+      }
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+    unsigned int half1, half0, sample;
+
+    cli();
+    if ((dcc_period1_n < ADAPT_MIN_PERIODS) || (dcc_period0_n < ADAPT_MIN_PERIODS))
+      {                                         // not enough data (e.g. no DCC signal)
+        sei();
+        return;
+      }
+    half1 = dcc_period1_avg16 >> 5;             // average (/16) and half (/2)
+    half0 = dcc_period0_avg16 >> 5;
+    dcc_period1_n = 0;
+    dcc_period0_n = 0;
+    sei();
+
+    sample = (half1 + half0) >> 1;
+    if (sample < SAMPLE_MIN) sample = SAMPLE_MIN;
+    if (sample > SAMPLE_MAX) sample = SAMPLE_MAX;
+    dcc_t0_reload = 256 - sample;               // Timer0 and Timer1 count at the same rate
+
+    dcc_timing.sample_point = T12US(sample);
+    dcc_timing.half1 = T12US(half1);
+    dcc_timing.half0 = T12US(half0);
+    if ((half1 >= sample) || (half0 <= sample)) dcc_timing.margin = 0;
+    else if ((sample - half1) < (half0 - sample)) dcc_timing.margin = T12US(sample - half1);
+    else dcc_timing.margin = T12US(half0 - sample);
+#endif
+  }
+
+
 unsigned char Recstate;         
 
 
@@ -172,6 +579,21 @@ void init_dcc_receiver(void)
     #endif
 
 
+    dcc_ring_head = 0;
+    dcc_ring_tail = 0;
+    dcc_ring_overflows = 0;
+    dcc_errors.checksum = 0;
+    dcc_errors.too_long = 0;
+    dcc_errors.framing = 0;
+    dcc_errors.preamble = 0;
+    dcc_filter.enabled = 0;                     // pass everything until init_dcc_decode()
+    dcc_bidi = (my_eeprom_read_byte(&CV.BiDi) != 0);
+    cutout_state = CUTOUT_OFF;
+    dcc_accepted = 0;
+    dcc_filtered = 0;
+    dcc_presence.present = 1;                   // until the first window proves otherwise
+
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
     TC0_Control_Register_A |= (0 << WGM00)			// Timer0: Normal mode
                            |  (0 << WGM01)
                            |  (0 << TC0_Compare_Match_Output_0)
@@ -181,11 +603,15 @@ void init_dcc_receiver(void)
                            |  (0 << CS01)			//            : 0  0  1 = run 1:1
                            |  (0 << CS00);			//            : 0  1  0 = run with prescaler 8
 
-    TCNT0 = 256L - T77US;  
+    dcc_t0_reload = 256L - T77US;
+    dcc_period1_avg16 = 16 * US2T1(116L);       // start with the nominal values
+    dcc_period0_avg16 = 16 * US2T1(200L);
+    dcc_period1_n = 0;
+    dcc_period0_n = 0;
+    dcc_timing.sample_point = 77;
+    TCNT0 = dcc_t0_reload;
     // OCR0 is unused -> Flags!
 
-    semaphor_get(C_Received);
-
     TC0_Interrupt_Mask_Register |= (1<<TOIE0);       // Timer0 Overflow
     // End of init Timer0
     
@@ -194,6 +620,14 @@ void init_dcc_receiver(void)
     // For correct detection of the DCC packets, we have to trigger on the risinging edge of the input (J) signal
     Interrupt_Control_Register |= (1<<DCC_Interrupt_Sense_Control_Bit_1)  // The rising edge of the signal 
                                |  (1<<DCC_Interrupt_Sense_Control_Bit_0); // generates an interrupt request.
+#else
+    // Timer0 is not used; the edges are timestamped with Timer1 (see init_timer1)
+    // Init Interrupt for DCC Port (INT1)
+    Interrupt_Select_Register |= (1<<DCC_Interrupt_Port);
+    // Both edges of the input signal generate an interrupt request
+    Interrupt_Control_Register |= (0<<DCC_Interrupt_Sense_Control_Bit_1)
+                               |  (1<<DCC_Interrupt_Sense_Control_Bit_0);
+#endif
   }
 
 
@@ -221,10 +655,13 @@ void init_dcc_receiver(void)
 //                           |----------->|
 //                                        ^Timer-INT: reads one
 //           
-// Result:   1. The received message is collected in the struct "local"
-//           2. After receiving a complete message, data is copied to
-//              "incoming".
-//           3. The flag C_Received is set.
+// Result:   1. The received message is collected directly in the slot
+//              dcc_ring[dcc_ring_head]. Main never reads this slot, since
+//              the ring always keeps one slot free.
+//           2. After receiving a complete message, dcc_ring_head is
+//              advanced, which tells main a new message is waiting.
+//              No data is copied; the slot is frozen until main has
+//              released it.
 //
 
 // For documentation purposes here just a repetition of the defines in dcc_receiver.h
@@ -235,11 +672,6 @@ void init_dcc_receiver(void)
 //     unsigned char dcc[MAX_DCC_SIZE];  // the dcc content
 //   } t_message;
 
-t_message incoming;
-
-volatile t_message local;
-
-
 struct
     {
         unsigned char state;                    // current state
@@ -249,6 +681,8 @@ struct
         signed char dcc_time;                   // integration time for dcc (only sampling code)
                                                 // we start with -7 -> all values >= indicate a zero
         unsigned char filter_data;              // bitfield for low pass data
+        unsigned char xor_sum;                  // running XOR of all received bytes
+        unsigned char drop;                     // 1: rejected by the address prefilter
     } dccrec;
 
 // some states:
@@ -263,74 +697,73 @@ struct
 
 
 
-// ISR(INT0) loads only a register and stores this register to IO.
-// this influences no status flags in SREG.
-// therefore we define a naked version of the ISR with
-// no compiler overhead.
-
-ISR(DCC_Interrupt_Vector) 
-{
-
-
-#if defined ENHANCED_PROCESSOR
-    TC0_Control_Register_B |= (T0_PRESCALER_BITS);  // Start Timer 0
-#else 
-  TC0_Control_Register_A  = (0 << FOC0)             // force output: 0=not
-                          | (0 << WGM00)            // wgm = 00: normal mode, top=0xff
-                          | (0 << COM01)            // com = 00: normal mode, pin operates as usual
-                          | (0 << COM00) 
-                          | (0 << WGM01)            // 
-                          | (T0_PRESCALER_BITS);    //   = run 
-#endif  
-}
-
-
 const unsigned char copy[] PROGMEM = {"OpenDecoder2.2"};
 
 #if (TARGET_HARDWARE == OPENDECODER22GBM)
 volatile unsigned char new_adc_requested;    // Flag to signal new ADC conversion should start 
 #endif
 
+// mydcc holds the value of the bit that was just received
+#define mydcc (Recstate & (1<<RECSTAT_DCC))
 
 
-ISR(TIMER0_OVF_vect)
+//------------------------------------------------------------------------------
+// The address prefilter. Called once per message, when the second byte is
+// complete: at that moment the address is known for all kinds of messages.
+// Returns 1 if the message is of no interest to this decoder; it is then still
+// received (to find the end of the message and to check it), but not published.
+// The rules must match those of analyze_message() in dcc_decode.c; the Lenz
+// correction is the same function (dcc_lenz_correction() in dcc_receiver.h).
+static inline unsigned char dcc_prefilter_drop(void) __attribute__((always_inline));
+unsigned char dcc_prefilter_drop(void)
   {
-    #define mydcc (Recstate & (1<<RECSTAT_DCC))
-
-    // read asap to keep timing!
-    if (DCCIN_STATE) Recstate &= ~(1<<RECSTAT_DCC);  // if high -> mydcc=0
-    else             Recstate |= 1<<RECSTAT_DCC;    
-
-    // Stop the timer
-    TC0_Control_Register_B = (0 << CS02)		// cs02.01.00 : 0  0  0 = Timer0: stopped
-                           | (0 << CS01)		//            : 0  0  1 = run 1:1
-                           | (0 << CS00);		//            : 0  1  0 = run with prescaler 8
-
-
-    // Interrupt occurs at MAX+1 (=256)
-    // set Timer Value to 256 - (3/4 of period of a one) -> this is a time window of 116*0,75=87us
-    // minus 10 us for safety
-    
-    TCNT0 = 256L - T77US;  
+    unsigned char b0 = dcc_ring[dcc_ring_head].dcc[0];
+    unsigned char b1 = dcc_ring[dcc_ring_head].dcc[1];
+    unsigned int addr;
+    unsigned char i;
 
-    // Next lines added by AP for GBM
-    // Start new ADC in case the ADC read process (defined in occupancy.c) is ready 
-    // We start new AD conversions in case mydcc is set
-    // In that case the J signal is high compared to K (the ground)
-    // But, since the opto-coupler inverses the signal, the DCC INT1 signal is zero
-#if (TARGET_HARDWARE == OPENDECODER22GBM)
-    if (new_adc_requested) 
-    {
-      if (mydcc) 
+    if (b0 == 0) return(0);                             // broadcast / reset
+    if (b0 <= 127)                                      // short loco address, service mode
+      return((b0 < 112) && (b0 != dcc_filter.short_addr));
+    if (b0 <= 191)                                      // accessory
       {
-        ADCSRA |= (1 << ADSC);         // Start the new ADC measurements
-        new_adc_requested = 0;
+        if (b1 & 0x80)
+          {                                             // basic accessory (9 bit)
+            if (dcc_filter.extended) return(1);
+            addr = (b0 & 0x3F) | ((~b1 & 0x70) << 2);
+            if (addr == 0x01FF) return(0);              // broadcast (before the Lenz correction)
+            if (dcc_filter.lenz) addr = dcc_lenz_correction(addr);
+            if (addr == dcc_filter.dec_addr) return(0); // PoM for the accessory decoder
+            addr = (addr << 2) | ((b1 >> 1) & 0x03);    // port address
+            for (i = 0; i < ACC_WINDOWS; i++)             // fixed number of compares
+              if ((addr >= dcc_filter.acc[i].first) && (addr <= dcc_filter.acc[i].last)) return(0);
+            return(1);
+          }
+        else
+          {                                             // extended accessory (11 bit)
+            if (!dcc_filter.extended) return(1);
+            addr = ((b1 & 0x06) >> 1) | ((b0 & 0x3F) << 2) | ((~b1 & 0x70) << 4);
+            return((addr != 0x07FF) && (addr != dcc_filter.dec_addr));
+          }
       }
-    }
-#endif
-    
-    
+    if (b0 <= 231)                                      // long loco address
+      {
+        addr = ((b0 & 0x3F) << 8) | b1;
+        return(addr != dcc_filter.loco_addr);
+      }
+    return(1);                                          // reserved and idle
+  }
+
+
+//------------------------------------------------------------------------------
+// The bit level state machine. It is shared by both receiver modes, and is
+// called once per received bit, after the bit value is stored in mydcc.
+// Inlined into the calling ISR, to avoid the overhead of a function call.
+static inline void dcc_receive_bit(void) __attribute__((always_inline));
+void dcc_receive_bit(void)
+  {
     dccrec.bitcount++;
+    dcc_bits++;                                         // presence monitor
 
     if (Recstate & (1<<RECSTAT_WF_PREAMBLE))            // wait for preamble
       {                                       
@@ -343,6 +776,10 @@ ISR(TIMER0_OVF_vect)
           }
         else
           {
+            if (dccrec.bitcount > 2)                    // not directly after the end bit
+              {
+                if (dcc_errors.preamble != 0xFFFF) dcc_errors.preamble++;
+              }
             dccrec.bitcount=0;
           }
       }
@@ -357,6 +794,8 @@ ISR(TIMER0_OVF_vect)
             Recstate = 1<<RECSTAT_WF_BYTE;
             dccrec.bitcount=0;
             dccrec.accubyte=0;
+            dccrec.xor_sum=0;
+            dccrec.drop=0;
           }
       }
     else if (Recstate & (1<<RECSTAT_WF_BYTE))           // wait for byte
@@ -376,16 +815,14 @@ ISR(TIMER0_OVF_vect)
          */
 
         if (dccrec.bitcount==8)
-          {
-            if (dccrec.bytecount == MAX_DCC_SIZE)       // too many bytes
-              {                                         // ignore message
-                Recstate = 1<<RECSTAT_WF_PREAMBLE;   
-              }
-            else
+          {                                             // the trailer check guarantees
+            dcc_ring[dcc_ring_head].dcc[dccrec.bytecount++] = my_accubyte;  // there is room
+            dccrec.xor_sum ^= my_accubyte;
+            if ((dccrec.bytecount == 2) && dcc_filter.enabled)
               {
-                local.dcc[dccrec.bytecount++] = dccrec.accubyte;
-                Recstate = 1<<RECSTAT_WF_TRAILER; 
+                dccrec.drop = dcc_prefilter_drop();
               }
+            Recstate = 1<<RECSTAT_WF_TRAILER; 
           }
       }
     else if (Recstate & (1<<RECSTAT_WF_TRAILER))        // wait for 0 (next byte) 
@@ -394,22 +831,44 @@ ISR(TIMER0_OVF_vect)
           {  // trailing "1" received
             Recstate = 1<<RECSTAT_WF_PREAMBLE;
             dccrec.bitcount=1;
+            if (dcc_bidi) cutout_arm();
 
-            if (semaphor_query(C_Received))
-              {
-                // panic - nobody is reading the messages :-((
+            unsigned char next_head = (dcc_ring_head + 1) & DCC_RING_MASK;
+            if (dccrec.bytecount < 3)
+              {                                         // end bit where a byte should follow
+                if (dcc_errors.framing != 0xFFFF) dcc_errors.framing++;
+              }
+            else if (dccrec.xor_sum)
+              {                                         // checksum error, ignore message
+                if (dcc_errors.checksum != 0xFFFF) dcc_errors.checksum++;
               }
             else
-              {                                         // copy from local to global
-                unsigned char i;
-                for (i=0; i<MAX_DCC_SIZE; i++)
+              {                                         // a valid message
+                dcc_valid++;
+                if (dcc_ring[dcc_ring_head].dcc[0] == 0xFF) dcc_idle++;
+                if (dccrec.drop)
+                  {                                     // not for us (or idle)
+                    dcc_filtered++;
+                  }
+                else if (next_head == dcc_ring_tail)
                   {
-                     incoming.dcc[i] = local.dcc[i];
+                    // ring full - main is busy for too long, drop this message
+                    if (dcc_ring_overflows != 0xFFFF) dcc_ring_overflows++;
+                  }
+                else
+                  {                                     // publish the slot
+                    dcc_accepted++;
+                    dcc_ring[dcc_ring_head].size = dccrec.bytecount;
+                    __asm__ __volatile__ ("" ::: "memory"); // slot must be complete before it is published
+                    dcc_ring_head = next_head;          // ---> tell the main prog!
                   }
-                incoming.size = dccrec.bytecount;
-                semaphor_set(C_Received);                   // ---> tell the main prog!
               }
-            
+          }
+        else if (dccrec.bytecount == MAX_DCC_SIZE)
+          {                                             // too many bytes, ignore message
+            if (dcc_errors.too_long != 0xFFFF) dcc_errors.too_long++;
+            Recstate = 1<<RECSTAT_WF_PREAMBLE;
+            dccrec.bitcount=0;
           }
         else
           {
@@ -423,3 +882,241 @@ ISR(TIMER0_OVF_vect)
         Recstate = 1<<RECSTAT_WF_PREAMBLE;
       }
   }
+
+
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+//------------------------------------------------------------------------------
+// Receiver mode 1: sampling 77us after the rising edge
+// 
+// Cost per DCC bit (estimated from the -Os instruction sequence, ATmega16):
+// - ISR(INT1):        2 interrupts per bit in total; this one costs roughly
+//                     25 cycles including entry, prologue and reti
+// - ISR(TIMER0_OVF):  roughly 90 cycles including the state machine, also at
+//                     the end of a message (the slot is published, not copied)
+// Total: about 115 cycles (10.4us at 11.0592 MHz) per bit, 2 interrupts per bit.
+// The period measurement for the adaptive sample point adds roughly 50 cycles
+// to ISR(INT1), after Timer0 has been started, and 5 to ISR(TIMER0_OVF):
+// about 170 cycles per bit.
+#if (T0_PRESCALER != 8)
+  #error The adaptive sample point assumes that Timer0 and Timer1 count at the same rate
+#endif
+
+// ISR(INT0) loads only a register and stores this register to IO.
+// this influences no status flags in SREG.
+// therefore we define a naked version of the ISR with
+// no compiler overhead.
+
+ISR(DCC_Interrupt_Vector) 
+{
+
+
+#if defined ENHANCED_PROCESSOR
+    TC0_Control_Register_B |= (T0_PRESCALER_BITS);  // Start Timer 0
+#else 
+  TC0_Control_Register_A  = (0 << FOC0)             // force output: 0=not
+                          | (0 << WGM00)            // wgm = 00: normal mode, top=0xff
+                          | (0 << COM01)            // com = 00: normal mode, pin operates as usual
+                          | (0 << COM00) 
+                          | (0 << WGM01)            // 
+                          | (T0_PRESCALER_BITS);    //   = run 
+#endif  
+    unsigned int now = TCNT1;
+    unsigned int period;
+
+    if (cutout_state)
+      {                                         // measuring the RailCom cutout: no sampling
+        TC0_Control_Register_B = 0;             // stop Timer0 again
+        TCNT0 = dcc_t0_reload;
+        cutout_edge(now);
+        return;
+      }
+
+    period = dcc_period_held;
+    dcc_period_held = t1_ticks_between(dcc_last_edge, now);
+    dcc_last_edge = now;
+
+    // The held period lies between the bit that has just ended and the one
+    // before it. If they differ (J and K swapped), it belongs to neither.
+    // (mydcc is not used: a state change in dcc_receive_bit() clears it.)
+    unsigned char bits = dcc_sampled_bits;
+    if ((bits ^ (bits >> 1)) & 1)
+      return;
+    if (bits & 1)
+      {
+        if ((period >= PERIOD1_MIN) && (period < PERIOD1_MAX))
+          {
+            dcc_period1_avg16 += period - (dcc_period1_avg16 >> 4);
+            if (dcc_period1_n != 255) dcc_period1_n++;
+          }
+      }
+    else
+      {
+        if ((period >= PERIOD0_MIN) && (period <= PERIOD0_MAX))
+          {
+            dcc_period0_avg16 += period - (dcc_period0_avg16 >> 4);
+            if (dcc_period0_n != 255) dcc_period0_n++;
+          }
+      }
+}
+
+
+ISR(TIMER0_OVF_vect)
+  {
+    // read asap to keep timing!
+    if (DCCIN_STATE) Recstate &= ~(1<<RECSTAT_DCC);  // if high -> mydcc=0
+    else             Recstate |= 1<<RECSTAT_DCC;    
+    dcc_sampled_bits = (dcc_sampled_bits << 1) | (mydcc ? 1 : 0);
+
+    // Stop the timer
+    TC0_Control_Register_B = (0 << CS02)		// cs02.01.00 : 0  0  0 = Timer0: stopped
+                           | (0 << CS01)		//            : 0  0  1 = run 1:1
+                           | (0 << CS00);		//            : 0  1  0 = run with prescaler 8
+
+
+    // Interrupt occurs at MAX+1 (=256)
+    // set Timer Value to 256 - (3/4 of period of a one) -> this is a time window of 116*0,75=87us
+    // minus 10 us for safety. This 77us is the start value; dcc_timing_tick() moves
+    // the sample point to the midpoint between the measured half-bits.
+    
+    TCNT0 = dcc_t0_reload;  
+
+    // Next lines added by AP for GBM
+    // Start new ADC in case the Timer 2 ISR requested one (see adc_hardware.c)
+    // We start new AD conversions in case mydcc is set
+    // In that case the J signal is high compared to K (the ground)
+    // But, since the opto-coupler inverses the signal, the DCC INT1 signal is zero
+#if (TARGET_HARDWARE == OPENDECODER22GBM)
+    if (new_adc_requested) 
+    {
+      if (mydcc) 
+      {
+        ADCSRA |= (1 << ADSC);         // Start the new ADC measurements
+        new_adc_requested = 0;
+      }
+    }
+#endif
+    
+    dcc_receive_bit();
+  }
+
+
+#else
+//------------------------------------------------------------------------------
+// Receiver mode 2: edge capture - NOT RECOMMENDED on the OpenDecoder 2.2 PCB
+//
+// This mode has no benefit over the sampling mode on this PCB: the Timer1
+// input capture pin (ICP1 = PD6) is connected to the program button, so the
+// edges are timestamped by software, with the same interrupt latency as the
+// sampling mode. It needs 2 interrupts and more cycles per bit. It is kept for
+// PCBs that route DCC to ICP1, and for comparison in the host replay.
+//
+// INT1 fires on every edge of the DCC input. The ISR timestamps the edge with
+// the free running Timer1 (the 20ms tick timer, see timer1.c) and classifies
+// the width of the half-bit that just ended with a single threshold, halfway
+// between the NMRA limits (S-9.1) for a 1 (52us .. 64us) and a 0 (90us ..
+// 10000us):
+// - half of a 1 bit:  35us .. 77us
+// - half of a 0 bit:  77us .. 10000us
+// The timestamp is read by software, so it includes the latency of the ISRs
+// that are active at the edge (the timer1 tick ISR runs with interrupts enabled,
+// the ADC and Timer2 ISRs do not). A late edge makes one half-bit longer and
+// the next one shorter by the same time; the wide windows absorb that, where
+// the NMRA limits did not (a few us of jitter already broke messages).
+// Two successive halves of the same kind form one bit, which is handed to the
+// same state machine as in the sampling mode. A half-bit of the other kind
+// resynchronises the pairing, which is how the leading 0 after the preamble
+// aligns the halves. A half-bit above 10000us aborts the message that is
+// being received.
+// Glitches: no DCC edge follows the previous one within 35us, so such an edge
+// belongs to a spike and is ignored. If the spike itself is shorter than 15us,
+// its first edge was accepted as the end of a (short) half-bit; if that edge
+// only started a new bit (dcc_first_half), it is undone. So a spike inside a
+// half-bit of a 1 or a 0 does not break the message.
+//
+// Cost per DCC bit (estimated from the -Os instruction sequence, ATmega16):
+// - ISR(INT1), first half:   roughly 70 cycles (timestamp, classify, undo data)
+// - ISR(INT1), second half:  roughly 65 cycles plus 65 cycles state machine,
+//                            also at the end of a message
+// Total: about 200 cycles (18us at 11.0592 MHz) per bit, 2 interrupts per bit,
+// against about 115 cycles for the sampling mode.
+#define HALF_MIN            US2T1(35L)          // shorter: an edge of a spike
+#define SPIKE_MAX           US2T1(15L)          // shorter: the previous edge started the spike
+#define HALF_SPLIT          US2T1(77L)          // shorter: half of a 1, else of a 0
+#define HALF_MAX            US2T1(10000L)
+#define HALF_NONE           2                   // no first half-bit received yet
+
+unsigned char dcc_first_half = HALF_NONE;       // 0, 1 or HALF_NONE
+unsigned char dcc_undo;                         // 1: the last edge only set dcc_first_half
+unsigned char dcc_undo_half;                    // dcc_first_half before the last edge
+unsigned int  dcc_undo_edge;                    // dcc_last_edge before the last edge
+
+
+ISR(DCC_Interrupt_Vector)
+  {
+    unsigned int now = TCNT1;                   // read asap to keep timing!
+    unsigned int width;
+    unsigned char half;
+
+    if (cutout_state)
+      {                                         // measuring the RailCom cutout
+        cutout_edge(now);
+        if (!cutout_state) dcc_first_half = HALF_NONE;
+        dcc_last_edge = now;
+        return;
+      }
+
+    width = t1_ticks_between(dcc_last_edge, now);
+    if (width < HALF_MIN)
+      {                                         // an edge of a spike
+        if (dcc_undo && (width < SPIKE_MAX))
+          {                                     // the last edge started the spike
+            dcc_last_edge = dcc_undo_edge;
+            dcc_first_half = dcc_undo_half;
+          }
+        dcc_undo = 0;
+        return;
+      }
+    dcc_undo_edge = dcc_last_edge;
+    dcc_last_edge = now;
+    dcc_undo = 0;
+
+#if (TARGET_HARDWARE == OPENDECODER22GBM)
+    // Start a new ADC conversion at the falling edge of DCCIN: J is now high
+    // compared to K (see the comments in the sampling mode)
+    if (new_adc_requested)
+      {
+        if (!DCCIN_STATE)
+          {
+            ADCSRA |= (1 << ADSC);
+            new_adc_requested = 0;
+          }
+      }
+#endif
+
+    if (width < HALF_SPLIT) half = 1;
+    else if (width <= HALF_MAX) half = 0;
+    else
+      {                                         // out of spec
+        if (Recstate & ((1<<RECSTAT_WF_BYTE) | (1<<RECSTAT_WF_TRAILER)))
+          {                                     // the message is broken off
+            if (dcc_errors.framing != 0xFFFF) dcc_errors.framing++;
+          }
+        dcc_first_half = HALF_NONE;
+        Recstate = 1<<RECSTAT_WF_PREAMBLE;
+        dccrec.bitcount = 0;
+        return;
+      }
+
+    if (half != dcc_first_half)
+      {                                         // first half of a new bit
+        dcc_undo_half = dcc_first_half;
+        dcc_first_half = half;
+        dcc_undo = 1;
+        return;
+      }
+    dcc_first_half = HALF_NONE;                 // second half: the bit is complete
+    if (half) Recstate |= 1<<RECSTAT_DCC;
+    else      Recstate &= ~(1<<RECSTAT_DCC);
+    dcc_receive_bit();
+  }
+#endif
@@ -26,12 +26,14 @@
 //------------------------------------------------------------------------
 //
 // howto:     Step 1: call init_dcc_receiver()
-//            Step 2: every time a new message is received, the
-//                    semaphor_set is called with C_Received = 1
-//            Step 3: The host program can now read the message incoming;
-//                    The message must be read within the next
-//                    2ms and must be checked by the host,
-//                    dcc_receiver makes only the physical layer.
+//            Step 2: every time a new message is received, the ISR
+//                    stores it in the next free slot of a ring buffer
+//            Step 3: The host program calls dcc_peek_message() until it
+//                    returns 0, and calls dcc_release_message() after
+//                    each message has been handled. The checksum and size
+//                    of the messages are already checked by the receiver.
+//            If main does not keep up and the ring is full, new messages
+//            are dropped and counted in dcc_ring_overflows.
 //
 
 #define MAX_DCC_SIZE  6
@@ -42,10 +44,130 @@ typedef struct
   } t_message;
 
 
-extern t_message incoming;         // here we deliver the incoming message
-
 void init_dcc_receiver(void);
 
+t_message *dcc_peek_message(void);  // oldest unread message, or 0 if none is waiting
+void dcc_release_message(void);     // the message returned by dcc_peek_message() is handled
+
+extern volatile unsigned int dcc_ring_overflows; // messages dropped because the ring was full
+
+// Messages with errors are discarded by the receiver; main only gets messages
+// with a correct checksum and a size of 3 .. MAX_DCC_SIZE.
+// All counters are 16 bit and saturate at 0xFFFF.
+typedef struct
+  {
+    unsigned int checksum;            // XOR over all bytes was not 0
+    unsigned int too_long;            // more than MAX_DCC_SIZE bytes
+    unsigned int framing;             // end bit after less than 3 bytes, or (edge
+                                      // capture) an invalid half-bit within a message
+    unsigned int preamble;            // preamble broken off by a 0 before 10 ones
+  } t_dcc_errors;
+
+extern volatile t_dcc_errors dcc_errors;
+extern volatile unsigned int dcc_valid;     // messages without errors (wraps around)
+extern volatile unsigned int dcc_idle;      // valid idle messages (wraps around)
+
+// Receiver statistics over a window of 1 second. Maintained by main, which
+// must call dcc_statistics_tick() every 20ms.
+typedef struct
+  {
+    unsigned int packets;             // valid packets in the last window
+    unsigned int idle_percent;        // idle packets in the last window, in % of the valid packets
+    unsigned int since_valid;         // ticks (20ms) since the last valid packet
+    unsigned int longest_gap;         // longest number of ticks without valid packets
+  } t_dcc_statistics;
+
+extern t_dcc_statistics dcc_statistics;
+
+void dcc_statistics_tick(void);
+void dcc_statistics_reset(void);    // clears the error and cutout counters, the longest gap and the losses
+
+// DCC presence, over windows of 100ms. Also maintained by dcc_statistics_tick().
+// The signal is lost after a window with less than 2 valid packets (booster 
+// tripped, track power off), and back after 2 good windows in a row. The bits
+// tell a missing signal (0) from a disturbed one.
+typedef struct
+  {
+    unsigned char present;            // 1: DCC signal present, 0: lost
+    unsigned int packets;             // valid packets in the last window
+    unsigned int bits;                // received bits in the last window
+    unsigned int losses;              // times the signal was lost (saturates at 0xFFFF)
+  } t_dcc_presence;
+
+extern t_dcc_presence dcc_presence;
+unsigned int dcc_read_counter(volatile unsigned int *counter);  // atomic read of a 16 bit counter
+
+// Measured timing of the DCC signal (sampling mode only). Maintained by main,
+// which must call dcc_timing_tick() every 20ms. All values are in us.
+typedef struct
+  {
+    unsigned int sample_point;        // sample delay after the rising edge
+    unsigned int margin;              // distance from the sample point to the nearest edge
+    unsigned int half1;               // average half-bit of a 1
+    unsigned int half0;               // average half-bit of a 0
+  } t_dcc_timing;
+
+extern t_dcc_timing dcc_timing;
+
+void dcc_timing_tick(void);
+
+// RailCom cutout measurement, only if CV BiDi is not 0. The counters saturate
+// at 0xFFFF. The times of the last cutout are in us after the end of the packet
+// end bit; they are updated by dcc_timing_tick().
+typedef struct
+  {
+    unsigned int detected;            // cutouts found after a packet end bit
+    unsigned int compliant;           // cutouts within the NMRA limits (S-9.3.2)
+    unsigned int missing;             // packet end bits without a cutout
+    unsigned int start;               // start (TCS), 0 if not visible with this wiring
+    unsigned int end;                 // end (TCE)
+    unsigned int length;              // TCE - TCS, 0 if the start was not visible
+  } t_dcc_cutout;
+
+extern volatile t_dcc_cutout dcc_cutout;
+
+// Accessory address windows. Window 0 is derived from CV1/CV9, windows 1..3
+// from CV110..CV121. Each window is a range of port addresses (decoder address
+// * 4 + port), mapped onto the devices from its first device on. Unused
+// windows have first > last.
+#define ACC_WINDOWS   4
+typedef struct
+  {
+    unsigned int  first;              // first port address of the window
+    unsigned int  last;               // last port address of the window
+    unsigned char device;             // TargetDevice of the first port address
+  } t_acc_window;
+
+// Address prefilter. The receiver only publishes broadcast and service mode
+// messages, and messages for our accessory windows or loco address. All other
+// messages (including idle) are counted in dcc_filtered and dropped.
+// The parameters are set by init_dcc_decode(); with enabled = 0 all valid
+// messages are published (as needed by DoProgramming).
+typedef struct
+  {
+    unsigned char enabled;
+    unsigned char extended;           // MyConfig: extended accessory decoder
+    unsigned char lenz;               // CV CmdStation: correct Lenz accessory addresses
+    unsigned int  dec_addr;           // My_Dec_Addr (PoM for the accessory decoder)
+    t_acc_window  acc[ACC_WINDOWS];   // accessory windows (also used by dcc_decode.c)
+    unsigned int  loco_addr;          // My_Loco_Addr (PoM and F1..F4)
+    unsigned char short_addr;         // My_Short_Addr (PoM and F1..F4), 0 if not used
+  } t_dcc_filter;
+
+extern t_dcc_filter dcc_filter;
+extern volatile unsigned int dcc_accepted;  // published messages (wraps around)
+extern volatile unsigned int dcc_filtered;  // dropped by the prefilter (wraps around)
+
+// Basic accessory address as sent by a LENZ central station -> decoder address.
+// Used by the prefilter and by analyze_accessory_message(), so they always agree.
+static inline unsigned int dcc_lenz_correction(unsigned int addr)
+       __attribute__((always_inline));
+unsigned int dcc_lenz_correction(unsigned int addr)
+  {
+    if (((addr & 0x3F) == 0) && (addr < 256)) addr += 64;
+    return(addr - 1);
+  }
+
 void activate_ACK(unsigned char time);          // make prog or feedback ack
 
 
@@ -24,6 +24,7 @@
 // 
 // RecDecPort (Received Decoder Port)
 // - Range = 0 .. 3
+// - For extended accessory decoders: the aspect. Range = 0 .. 31
 // 
 // TargetDevice (Number of the switch / relay this DCC command is targetted at)
 // - Range = 0 .. (NUMBER_OF_DEVICES - 1)
@@ -36,6 +37,7 @@
 // RecLocoAddr
 // - Range: 0..10238 (in theory)
 // - Acceptable values: LOCO_OFFSET .. LOCO_OFFSET + My_RS_Addr (or My_Dec_Addr)
+// - Or My_Short_Addr (1..127), if CV53 is set
 //  
 //  
 // Example of an accesory decoder message: 
@@ -78,6 +80,9 @@ unsigned char RS_Addr2Use;   // RS-bus address used by RS bus hardware routines
                              // Is equal to, or 1 higher (in case of SkipUnEven) than My_RS_Addr
 unsigned int  My_Loco_Addr;	 // Decoder listens to loco address to facilitate PoM and F1..F4
                              // Derived from LOCO_OFFSET and My_RS_Addr / My_Dec_Addr
+unsigned char My_Short_Addr;   // Short (7 bit) loco address for PoM and F1..F4, for throttles
+                             // that handle long addresses badly. Range: 1..127 / 0 if not used
+                             // Derived from CV53
 
 // Data extracted from received DCC packets.
 unsigned char CmdType;         // Received DCC command. For possible values see #defines above
@@ -93,9 +98,15 @@ unsigned int  RecLocoAddr;     // Received Loco Address. See below
 unsigned int  RecCvNumber;     // Configuration Variable to change. Range [0... ]
 unsigned char RecCvData;       // CV Value te set. Range [0..255]
 enum CvOpType RecCvOperation;  // CV Operation (most common: write or verify)
+// The next variable is set for every packet by analyze_message
+unsigned char RecRepeat;       // 1: first occurrence of this packet, 2: first repeat, ...
+// The next variables are used for F5..F28 (LOCO_F5F28_CMD). A packet carries one group
+// of 4 (F5..F8, F9..F12) or 8 (F13..F20, F21..F28) functions; bit 0 is the first function
+unsigned char RecFuncBase;     // Number of the first function in the group: 5, 9, 13 or 21
+unsigned char RecFuncState;    // Received value of the functions in the group
+unsigned char RecFuncChanged;  // Functions in the group that changed since the previous packet
 
 // Other shared data
-unsigned char DccSignalQuality;	// Counts number of checksum errors 
 unsigned char MyConfig;	        // The kind of accessory decoder we are. Basic = 0 / Extended = 1
 unsigned char MyType;	        // 48: normal / 49: reverser / 50: relays / 52: Speed
 
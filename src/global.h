@@ -30,6 +30,7 @@
 #define LOCO_F0F4_CMD	  3      // Locomotive for F0..F4  
 #define POM_CMD      	  4      // Programming on the Main (PoM) 
 #define SM_CMD 	          5      // Programming in Service Mode (SM = programming track) 
+#define LOCO_F5F28_CMD	  6      // Locomotive for F5..F28 (function group two and expansion)
 
 // Decoder types
 #define TYPE_SWITCH	  16      // Switch decoder  
@@ -65,6 +66,7 @@ extern unsigned int  My_Dec_Addr;	//
 extern unsigned char My_RS_Addr;	// Base value derived from CV10
 extern unsigned char RS_Addr2Use;	// Actual value being used. Can be 1 higher than base address
 extern unsigned int  My_Loco_Addr;	// OFFSET added to My_Dec_Addr / My_RS_Base_Addr
+extern unsigned char My_Short_Addr;	// Short loco address from CV53. 0 if not used
 extern unsigned char CmdType;
 extern unsigned int  RecDecAddr;
 extern unsigned char RecDecPort;
@@ -74,7 +76,10 @@ extern unsigned char TargetActivate;
 extern unsigned int  RecLocoAddr;
 extern unsigned int  RecCvNumber;
 extern unsigned char RecCvData;
-extern unsigned char DccSignalQuality;
+extern unsigned char RecRepeat;
+extern unsigned char RecFuncBase;
+extern unsigned char RecFuncState;
+extern unsigned char RecFuncChanged;
 extern unsigned char MyConfig;
 extern unsigned char MyType;
 extern enum CvOpType RecCvOperation;
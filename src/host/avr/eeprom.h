@@ -0,0 +1,21 @@
+//*****************************************************************************************************
+//
+// file:      host/avr/eeprom.h
+// purpose:   EEPROM shim for host builds. Variables in EEMEM are normal variables, so the 
+//            initial EEPROM content is that of the CV record in config.c.
+//
+//*****************************************************************************************************
+#ifndef _HOST_AVR_EEPROM_H_
+#define _HOST_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+
+#define EEMEM
+#define eeprom_read_byte(p)         (*(const uint8_t *)(p))
+#define eeprom_write_byte(p, v)     (*(uint8_t *)(p) = (v))
+#define eeprom_read_block(d, s, n)  memcpy((d), (s), (n))
+#define eeprom_busy_wait()          do {} while (0)
+
+#endif
@@ -0,0 +1,18 @@
+//*****************************************************************************************************
+//
+// file:      host/avr/interrupt.h
+// purpose:   Interrupt shim for host builds. An ISR becomes a normal function with the name of
+//            its vector, which the host program calls. The host program is single threaded,
+//            so sei() and cli() have nothing to do.
+//
+//*****************************************************************************************************
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector)     void vector(void)
+#define sei()           do {} while (0)
+#define cli()           do {} while (0)
+
+#endif
@@ -0,0 +1,147 @@
+//*****************************************************************************************************
+//
+// file:      host/avr/io.h
+// purpose:   Register shim for host (x86) builds of the receiver and decoder, see host/replay.c
+//            All I/O registers of the ATmega16 are mapped on a byte array, at their data memory 
+//            address. Only the registers and bits used by the decoder software are defined.
+//
+//*****************************************************************************************************
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t avr_io[0x60];                   // defined by the host program
+
+#define _SFR_IO8(a)     avr_io[(a) + 0x20]
+#define _SFR_IO16(a)    (*(volatile uint16_t *)&avr_io[(a) + 0x20])
+#define _BV(b)          (1 << (b))
+
+// Ports
+#define PINA            _SFR_IO8(0x19)
+#define DDRA            _SFR_IO8(0x1A)
+#define PORTA           _SFR_IO8(0x1B)
+#define PINB            _SFR_IO8(0x16)
+#define DDRB            _SFR_IO8(0x17)
+#define PORTB           _SFR_IO8(0x18)
+#define PINC            _SFR_IO8(0x13)
+#define DDRC            _SFR_IO8(0x14)
+#define PORTC           _SFR_IO8(0x15)
+#define PIND            _SFR_IO8(0x10)
+#define DDRD            _SFR_IO8(0x11)
+#define PORTD           _SFR_IO8(0x12)
+
+// ADC
+#define ADCW            _SFR_IO16(0x04)
+#define ADC             ADCW
+#define ADCL            _SFR_IO8(0x04)
+#define ADCH            _SFR_IO8(0x05)
+#define ADCSRA          _SFR_IO8(0x06)
+#define ADMUX           _SFR_IO8(0x07)
+
+// UART
+#define UBRRL           _SFR_IO8(0x09)
+#define UCSRB           _SFR_IO8(0x0A)
+#define UCSRA           _SFR_IO8(0x0B)
+#define UDR             _SFR_IO8(0x0C)
+#define UCSRC           _SFR_IO8(0x20)
+#define UBRRH           _SFR_IO8(0x20)
+
+// Timers
+#define OCR2            _SFR_IO8(0x23)
+#define TCNT2           _SFR_IO8(0x24)
+#define TCCR2           _SFR_IO8(0x25)
+#define ICR1            _SFR_IO16(0x26)
+#define OCR1B           _SFR_IO16(0x28)
+#define OCR1A           _SFR_IO16(0x2A)
+#define TCNT1           _SFR_IO16(0x2C)
+#define TCCR1B          _SFR_IO8(0x2E)
+#define TCCR1A          _SFR_IO8(0x2F)
+#define TCNT0           _SFR_IO8(0x32)
+#define TCCR0           _SFR_IO8(0x33)
+#define MCUCR           _SFR_IO8(0x35)
+#define TIFR            _SFR_IO8(0x38)
+#define TIMSK           _SFR_IO8(0x39)
+#define GIFR            _SFR_IO8(0x3A)
+#define GICR            _SFR_IO8(0x3B)
+#define OCR0            _SFR_IO8(0x3C)
+#define SREG            _SFR_IO8(0x3F)
+
+// TCCR0
+#define FOC0    7
+#define WGM00   6
+#define COM01   5
+#define COM00   4
+#define WGM01   3
+#define CS02    2
+#define CS01    1
+#define CS00    0
+// TIMSK
+#define OCIE2   7
+#define TOIE2   6
+#define TICIE1  5
+#define OCIE1A  4
+#define OCIE1B  3
+#define TOIE1   2
+#define OCIE0   1
+#define TOIE0   0
+// TIFR
+#define ICF1    5
+#define TOV1    2
+#define TOV0    0
+// GICR, GIFR
+#define INT1    7
+#define INT0    6
+#define INT2    5
+#define INTF1   7
+#define INTF0   6
+// MCUCR
+#define ISC11   3
+#define ISC10   2
+#define ISC01   1
+#define ISC00   0
+// ADCSRA
+#define ADEN    7
+#define ADSC    6
+#define ADATE   5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+// ADMUX
+#define REFS1   7
+#define REFS0   6
+#define ADLAR   5
+#define MUX4    4
+#define MUX3    3
+#define MUX2    2
+#define MUX1    1
+#define MUX0    0
+// TCCR1A, TCCR1B
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+#define WGM11   1
+#define WGM10   0
+#define ICNC1   7
+#define ICES1   6
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+// TCCR2
+#define WGM21   3
+#define CS22    2
+#define CS21    1
+#define CS20    0
+// UART
+#define URSEL   7
+#define UCSZ1   2
+#define UCSZ0   1
+#define TXEN    3
+#define UDRE    5
+
+#endif
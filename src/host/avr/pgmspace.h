@@ -0,0 +1,18 @@
+//*****************************************************************************************************
+//
+// file:      host/avr/pgmspace.h
+// purpose:   Program memory shim for host builds: PROGMEM data are normal constants.
+//
+//*****************************************************************************************************
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define PROGMEM
+#define PSTR(s)                     (s)
+#define pgm_read_byte(p)            (*(const uint8_t *)(p))
+#define pgm_read_word(p)            (*(const uint16_t *)(p))
+
+#endif
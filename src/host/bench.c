@@ -0,0 +1,419 @@
+//*****************************************************************************************************
+//
+// OpenDCC - OpenDecoder2.2
+//
+// This source file is subject of the GNU general public license 2, that is available at
+// http://www.gnu.org/licenses/gpl.txt
+//
+//*****************************************************************************************************
+//
+// file:      host/bench.c
+// purpose:   Host (x86 / Linux) microbenchmark for analyze_message() and cv_operation(), and for
+//            the evaluation of the ADC samples (adc_hardware.c).
+//            dcc_decode.c and cv_pom.c (and relays.c and led.c, which dcc_decode.c calls for the
+//            safe state) are compiled for the host against the register and EEPROM shim in
+//            host/avr. Messages are passed to analyze_message() directly, as they come out of
+//            the receiver ring (the receiver and its prefilter are not part of the measurement).
+//            PoM and SM commands are passed to cv_operation(), like main() does.
+//            For every class of traffic, a stream of STREAM_SIZE messages is generated with a
+//            fixed seed; every message is sent twice, as command stations do. The stream is
+//            replayed until the requested number of packets is reached. This is repeated, and
+//            after an untimed warm-up run the median of the runs is reported, with the spread
+//            (half the difference between the slowest and the fastest run, in % of the median).
+//            A spread of more than a few % means the host was busy: use more or longer runs.
+//            No memory is allocated; the streams are static.
+//            The command counts are those of one pass over the stream. They do not depend on
+//            the host, and change only if the decoding changes.
+//            Classes:
+//              idle       idle packets
+//              loco       speed packets for other locos (7 and 14 bit)
+//              accessory  basic accessory packets, 1 in 8 for our decoder address
+//              pom        PoM verify and write for our loco address
+//              sm         service mode (after a reset packet): direct, register and paged mode
+//              mix        a mix of traffic as seen on a layout (as host/replay.c)
+//            Host timings do not translate into AVR cycles; use them to compare versions of the
+//            decode path on the same host.
+//            ADC scan: a scan is what the decoder does in 16 ms: 8 ADC interrupts (one per input
+//            pin) and detect_occupied_tracks(), here always with a 10 ms step of the off delays.
+//            The samples of SCAN_STREAM scans are generated with the same seed: trains enter and
+//            leave the inputs, with spikes in between. The counts are the changes of the on and
+//            off bits in one pass.
+//
+// usage:     bench [-n packets] [-r runs] [-s seed]
+//              -n <packets>    packets per run and class (default 5000000, about 0.15 s)
+//              -r <runs>       runs per class (default 7, at most MAX_RUNS)
+//              -s <seed>       seed for the random generator (default 1)
+//
+// build:     make bench (see Makefile)
+//
+//*****************************************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+#include "../global.h"
+#include "../config.h"
+#include "../hardware.h"
+#include "../dcc_receiver.h"
+#include "../dcc_decode.h"
+#include "../myeeprom.h"
+#include "../cv_pom.h"
+#include "../adc_hardware.h"
+#include "../rs_bus_hardware.h"
+
+volatile uint8_t avr_io[0x60];                  // the register file, see host/avr/io.h
+
+// Addresses used by the streams; they are also set in the decoder (as host/replay.c)
+#define MY_DEC_ADDR         10                  // accessory decoder address (0 based)
+#define MY_LOCO_ADDR        (LOCO_OFFSET + 5)   // loco address for PoM and F1..F4
+#define MY_SHORT_ADDR       3                   // short loco address for PoM and F1..F4
+
+#define STREAM_SIZE         4096                // messages per stream (even: sent twice)
+
+
+//*****************************************************************************************************
+// Stub for the RS-bus routine used by cv_pom.c
+//*****************************************************************************************************
+unsigned long rs_bus_sent;                      // CV values sent back after PoM verify
+
+void send_CV_value_via_RSbus(unsigned char value) { (void)value; rs_bus_sent++; }
+
+unsigned char save_cv_value_in_EEPROM(unsigned int cv);
+
+
+//*****************************************************************************************************
+// The streams
+//*****************************************************************************************************
+t_message stream[STREAM_SIZE];
+
+unsigned char checksum(unsigned char *data, unsigned char size)
+{ unsigned char i, xor = 0;
+  for (i = 0; i < size; i++) xor ^= data[i];
+  return(xor);
+}
+
+// A CV that can be written with its current value without side effects. CV10 (restart)
+// and the CVs that are not saved (CV8: reset, CV25: restart) are avoided
+unsigned int gen_cv(void)
+{ unsigned int cv;
+  do cv = rand() % 121; while (!save_cv_value_in_EEPROM(cv) || (cv == (10-1)));
+  return(cv);
+}
+
+unsigned char gen_idle(unsigned char *data)
+{ data[0] = 0xFF; data[1] = 0x00;
+  return(2);
+}
+
+unsigned char gen_loco(unsigned char *data)
+{ unsigned int addr;
+  if (rand() & 1)
+  { do data[0] = 1 + rand() % 111; while (data[0] == MY_SHORT_ADDR);  // 7 bit loco, speed
+    data[1] = 0x60 | (rand() & 0x1F);
+    return(2);
+  }
+  do addr = 128 + rand() % 9000; while (addr == MY_LOCO_ADDR);
+  data[0] = 0xC0 | (addr >> 8);                 // 14 bit loco, 128 speed steps
+  data[1] = addr & 0xFF;
+  data[2] = 0x3F;
+  data[3] = rand() & 0xFF;
+  return(4);
+}
+
+unsigned char gen_accessory(unsigned char *data)
+{ unsigned int addr = rand() % 256;             // basic accessory, any decoder
+  if ((rand() & 7) == 0) addr = MY_DEC_ADDR + 1;  // (Lenz: wire address = decoder address + 1)
+  data[0] = 0x80 | (addr & 0x3F);
+  data[1] = 0x80 | ((~addr >> 2) & 0x70) | (rand() & 0x0F);
+  return(2);
+}
+
+unsigned char gen_pom(unsigned char *data)
+{ unsigned int cv = gen_cv();
+  data[0] = 0xC0 | (MY_LOCO_ADDR >> 8);
+  data[1] = MY_LOCO_ADDR & 0xFF;
+  if (rand() & 1)
+  { data[2] = 0xE4 | (cv >> 8);                 // verify
+    data[3] = cv & 0xFF;
+    data[4] = 0;
+  }
+  else
+  { data[2] = 0xEC | (cv >> 8);                 // write the current value
+    data[3] = cv & 0xFF;
+    data[4] = ((unsigned char *) &CV_RAM)[cv];
+  }
+  return(5);
+}
+
+unsigned char gen_sm(unsigned char *data)
+{ unsigned int r = rand() % 8;
+  unsigned int cv = gen_cv();
+  unsigned char value = ((unsigned char *) &CV_RAM)[cv];
+  switch (r)
+  { case 0:                                     // direct mode, verify byte
+    case 1:
+      data[0] = 0x74 | (cv >> 8); data[1] = cv & 0xFF; data[2] = value;
+      return(3);
+    case 2:                                     // direct mode, write byte (current value)
+      data[0] = 0x7C | (cv >> 8); data[1] = cv & 0xFF; data[2] = value;
+      return(3);
+    case 3:                                     // direct mode, verify bit
+      data[0] = 0x78 | (cv >> 8); data[1] = cv & 0xFF; data[2] = 0xE0 | (rand() & 0x0F);
+      return(3);
+    case 4:                                     // page register, write
+      data[0] = 0x7D; data[1] = 1;
+      return(2);
+    case 5:                                     // register 1..4, verify (page 1: CV1..CV4)
+      data[0] = 0x70 | (rand() & 3); data[1] = rand() & 0xFF;
+      return(2);
+    case 6:                                     // register 5 (CV29), verify
+      data[0] = 0x74; data[1] = CV_RAM.Config;
+      return(2);
+    default:                                    // reset packet, keeps service mode alive
+      data[0] = 0x00; data[1] = 0x00;
+      return(2);
+  }
+}
+
+// A mix of traffic as seen on a layout: mostly idle and packets for other decoders
+unsigned char gen_mix(unsigned char *data)
+{ unsigned int r = rand() % 100;
+  unsigned char size;
+  if (r < 40) return(gen_idle(data));
+  if (r < 75) return(gen_loco(data));
+  if (r < 90) return(gen_accessory(data));
+  if (r < 98)
+  { data[0] = MY_SHORT_ADDR;                    // our short loco address
+    if (r < 95) data[1] = 0x80 | (rand() & 0x1F);   // F0..F4
+    else data[1] = 0xA0 | (rand() & 0x1F);      // F5..F12
+    return(2);
+  }
+  size = gen_pom(data);
+  if (data[2] & 0x08) data[2] &= ~0x08;         // only PoM verify: a write would be rare
+  return(size);
+}
+
+// Fill the stream. Every message is sent twice. A service mode stream starts with reset packets
+void fill_stream(unsigned char (*gen)(unsigned char *), unsigned char sm)
+{ unsigned char data[MAX_DCC_SIZE];
+  unsigned char size;
+  unsigned int i;
+  for (i = 0; i < STREAM_SIZE; i += 2)
+  { if (sm && (i == 0)) {data[0] = 0x00; data[1] = 0x00; size = 2;}
+    else size = gen(data);
+    data[size] = checksum(data, size);
+    stream[i].size = size + 1;
+    memcpy(stream[i].dcc, data, size + 1);
+    stream[i + 1] = stream[i];
+  }
+}
+
+
+//*****************************************************************************************************
+// Measurement
+//*****************************************************************************************************
+unsigned long cmd_count[8];                     // messages per CmdType, in one pass
+
+// As main(): decode, and pass PoM and SM commands to cv_operation()
+static inline void handle(t_message *msg)
+{ analyze_message(msg);
+  if (CmdType == POM_CMD) cv_operation(POM_CMD);
+  if (CmdType == SM_CMD) cv_operation(SM_CMD);
+}
+
+double now_ns(void)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+#define MAX_RUNS            31
+
+double run_ns[MAX_RUNS];                        // time of every run, per packet or scan
+double spread;                                  // of the last median, in %
+
+int compare_ns(const void *a, const void *b)
+{ double d = *(const double *)a - *(const double *)b;
+  return((d > 0) - (d < 0));
+}
+
+// Returns the median of run_ns[0 .. runs-1] and sets spread
+double median(unsigned int runs)
+{ double mid;
+  qsort(run_ns, runs, sizeof(run_ns[0]), compare_ns);
+  mid = (runs & 1) ? run_ns[runs / 2] : (run_ns[runs / 2 - 1] + run_ns[runs / 2]) / 2;
+  spread = (run_ns[runs - 1] - run_ns[0]) / 2 / mid * 100.0;
+  return(mid);
+}
+
+// Returns the median time of the runs in ns/packet; run 0 is the warm-up run and is not timed
+double run(unsigned long packets, unsigned int runs)
+{ unsigned long n;
+  unsigned int i, r;
+  double start;
+  init_dcc_decode();                            // clears the repeat cache and service mode
+  memset(cmd_count, 0, sizeof(cmd_count));
+  for (i = 0; i < STREAM_SIZE; i++)
+  { handle(&stream[i]);
+    cmd_count[CmdType & 7]++;
+  }
+  for (r = 0; r <= runs; r++)
+  { init_dcc_decode();
+    start = now_ns();
+    for (n = 0, i = 0; n < packets; n++)
+    { handle(&stream[i]);
+      if (++i == STREAM_SIZE) i = 0;
+    }
+    if (r) run_ns[r - 1] = (now_ns() - start) / packets;
+  }
+  return(median(runs));
+}
+
+
+//*****************************************************************************************************
+// ADC scans
+//*****************************************************************************************************
+#define SCAN_STREAM         1024                // scans in the sample stream
+#define SAMPLE_FREE         3                   // ADC value of a free input (CV35/36: 20/15)
+#define SAMPLE_OCCUPIED     120                 // ADC value of an occupied input
+#define SCAN_DELAY_OFF      2                   // CV34 (100 ms steps), shorter than most free periods
+
+void ADC_vect(void);                            // ISR(ADC_vect), see host/avr/interrupt.h
+
+unsigned int scan_stream[SCAN_STREAM][8];
+unsigned long scan_on, scan_off;                // changes of the adc_on / adc_off bits, in one pass
+
+// Every input is occupied or free for 8 .. 135 scans; 1 in 64 samples is a spike of the other value
+void fill_scans(void)
+{ unsigned char occupied[8] = {0};
+  unsigned int  left[8] = {0};
+  unsigned int i, pin;
+  for (i = 0; i < SCAN_STREAM; i++)
+    for (pin = 0; pin < 8; pin++)
+    { if (left[pin] == 0) {occupied[pin] ^= 1; left[pin] = 8 + (rand() & 127);}
+      left[pin]--;
+      scan_stream[i][pin] = (occupied[pin] ^ ((rand() & 63) == 0)) ? SAMPLE_OCCUPIED : SAMPLE_FREE;
+      scan_stream[i][pin] += rand() & 3;        // noise
+    }
+}
+
+static inline void scan(const unsigned int *samples)
+{ unsigned char pin;
+  for (pin = 0; pin < 8; pin++)
+  { ADCW = samples[pin];
+    ADC_vect();
+  }
+  T_DelayOff = 10;
+  detect_occupied_tracks();
+}
+
+static inline unsigned char bits(unsigned char mask)
+{ unsigned char n = 0;
+  for (; mask; mask &= mask - 1) n++;
+  return(n);
+}
+
+// Returns the median time of the runs in ns/scan; run 0 is the warm-up run and is not timed
+double run_scans(unsigned long scans, unsigned int runs)
+{ unsigned long n;
+  unsigned int i, r;
+  unsigned char on, off;
+  double start;
+  CV_RAM.Delay_off = SCAN_DELAY_OFF;
+  init_occupied_tracks();
+  scan_on = scan_off = 0;
+  for (i = 0; i < SCAN_STREAM; i++)
+  { on = adc_on;
+    off = adc_off;
+    scan(scan_stream[i]);
+    scan_on += bits(on ^ adc_on);
+    scan_off += bits(off ^ adc_off);
+  }
+  for (r = 0; r <= runs; r++)
+  { init_occupied_tracks();
+    start = now_ns();
+    for (n = 0, i = 0; n < scans; n++)
+    { scan(scan_stream[i]);
+      if (++i == SCAN_STREAM) i = 0;
+    }
+    if (r) run_ns[r - 1] = (now_ns() - start) / scans;
+  }
+  return(median(runs));
+}
+
+
+//*****************************************************************************************************
+// Main
+//*****************************************************************************************************
+typedef struct
+  { const char *name;
+    unsigned char (*gen)(unsigned char *);
+    unsigned char sm;                           // service mode stream
+  } t_class;
+
+const t_class classes[] =
+  { {"idle",      gen_idle,      0},
+    {"loco",      gen_loco,      0},
+    {"accessory", gen_accessory, 0},
+    {"pom",       gen_pom,       0},
+    {"sm",        gen_sm,        1},
+    {"mix",       gen_mix,       0},
+  };
+
+void usage(void)
+{ fprintf(stderr, "usage: bench [-n packets] [-r runs] [-s seed]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{ unsigned long packets = 5000000;
+  unsigned int runs = 7;
+  unsigned int seed = 1;
+  unsigned int c;
+  double ns;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  { if (argv[i][0] != '-') usage();
+    switch (argv[i][1])
+    { case 'n': if (++i >= argc) usage(); packets = strtoul(argv[i], 0, 10); break;
+      case 'r': if (++i >= argc) usage(); runs = atoi(argv[i]); break;
+      case 's': if (++i >= argc) usage(); seed = atoi(argv[i]); break;
+      default:  usage();
+    }
+  }
+  if (!packets || !runs || (runs > MAX_RUNS)) usage();
+
+  // As init_global()
+  MyConfig = 0;
+  My_Dec_Addr = MY_DEC_ADDR;
+  My_Loco_Addr = MY_LOCO_ADDR;
+  My_Short_Addr = MY_SHORT_ADDR;
+  my_eeprom_load_cv();
+  init_dcc_receiver();
+
+  printf("%lu packets per run, median of %u runs after a warm-up run, seed %u, stream %u messages\n",
+         packets, runs, seed, STREAM_SIZE);
+  printf("class       ns/packet  spread   Mpackets/s   commands per stream: acc other F0-F4 F5-F28 PoM SM ignored\n");
+  for (c = 0; c < sizeof(classes) / sizeof(classes[0]); c++)
+  { srand(seed);
+    fill_stream(classes[c].gen, classes[c].sm);
+    ns = run(packets, runs);
+    printf("%-10s %10.1f %6.1f%% %12.2f   %25lu %5lu %5lu %6lu %3lu %2lu %7lu\n", classes[c].name, ns, spread, 1000.0 / ns,
+           cmd_count[ACCESSORY_CMD], cmd_count[ANY_ACCESSORY_CMD], cmd_count[LOCO_F0F4_CMD],
+           cmd_count[LOCO_F5F28_CMD], cmd_count[POM_CMD], cmd_count[SM_CMD], cmd_count[IGNORE_CMD]);
+  }
+
+  printf("\n%lu scans per run, median of %u runs after a warm-up run, stream %u scans\n", packets, runs, SCAN_STREAM);
+  printf("class       ns/scan    spread     Mscans/s   changes per stream: on  off\n");
+  srand(seed);
+  fill_scans();
+  ns = run_scans(packets, runs);
+  printf("%-10s %10.1f %6.1f%% %12.2f   %22lu %4lu\n", "adc scan", ns, spread, 1000.0 / ns, scan_on, scan_off);
+  return(0);
+}
@@ -0,0 +1,530 @@
+//*****************************************************************************************************
+//
+// OpenDCC - OpenDecoder2.2
+//
+// This source file is subject of the GNU general public license 2, that is available at
+// http://www.gnu.org/licenses/gpl.txt
+//
+//*****************************************************************************************************
+//
+// file:      host/replay.c
+// purpose:   Host (x86 / Linux) replay harness for the DCC receiver and the DCC decoder.
+//            dcc_receiver.c and dcc_decode.c (with relays.c and led.c, for the safe state) are
+//            compiled for the host against the register shim in host/avr. This program plays a
+//            trace of DCCIN edges through the receiver ISRs, and passes every published message
+//            to analyze_message(), like main() does.
+//            It emulates:
+//            - INT1, using the sense control bits in MCUCR and the enable bit in GICR
+//            - Timer0 (sampling receiver): started by the ISR, overflows after 256 - TCNT0
+//            - the Timer1 counter (edge capture, adaptive sample point, RailCom), TOP = ICR1
+//            - the 20ms tick of main (timerval and the tick functions of the receiver)
+//            Interrupt latency is not emulated.
+//
+// usage:     replay [options] [tracefile]
+//            Without a trace file, a synthetic trace is generated:
+//              -n <packets>    number of packets (default 10000)
+//              -p <bits>       preamble length (default 14)
+//              -j <us>         random jitter on every edge (default 0)
+//              -g <permille>   probability of a glitch per half-bit (default 0)
+//              -c              RailCom cutout after every packet (replaces 4 preamble bits)
+//              -x              J and K swapped (DCCIN inverted, except during the cutout)
+//              -l <ms>         no track power (DCCIN high) for ms, halfway through the trace
+//              -s <seed>       seed for the random generator (default 1)
+//              -o <file>       write the synthetic trace to a file
+//              -a <addr>       our accessory decoder address, 0 based (default 10)
+//              -e              extended accessory decoder (11 bit address, CV29 bit 5), with
+//                              relays and SafeMode bit 2; the extended broadcast with aspect 0
+//                              (absolute stop) is sent twice, halfway through the trace
+//              -r              command station repeats: pairs of messages, sent as m1 m2 m1 m2;
+//                              a PoM for our loco is paired with a speed packet for that loco,
+//                              a basic accessory command for us with one for another port
+//            Options for both:
+//              -b              set CV28 BiDi (measure the RailCom cutout)
+//              -v              print every message that main receives
+//            A trace file has one edge per line: <time in us> <level of DCCIN after the edge>
+//            Empty lines and lines starting with # are ignored.
+//
+// build:     make host (see Makefile). This builds replay (sampling receiver) and
+//            replay_capture (edge capture receiver).
+//
+//*****************************************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+#include "../global.h"
+#include "../config.h"
+#include "../hardware.h"
+#include "../dcc_receiver.h"
+#include "../dcc_decode.h"
+#include "../myeeprom.h"
+#include "../relays.h"
+
+volatile uint8_t avr_io[0x60];                  // the register file, see host/avr/io.h
+extern unsigned char safe_time;                 // relays.c
+
+// The ISRs of dcc_receiver.c
+void INT1_vect(void);
+#if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+void TIMER0_OVF_vect(void);
+#else
+#define TIMER0_OVF_vect()                       // Timer0 is not used, and never started
+#endif
+
+// Addresses used by the synthetic trace; they are also set in the decoder
+#define MY_DEC_ADDR         10                  // accessory decoder address (0 based), see -a
+#define MY_LOCO_ADDR        (LOCO_OFFSET + 5)   // loco address for PoM and F1..F4
+#define MY_SHORT_ADDR       3                   // short loco address for PoM and F1..F4
+
+#define HALF1               58.0                // us
+#define HALF0               100.0
+
+
+//*****************************************************************************************************
+// The trace
+//*****************************************************************************************************
+typedef struct
+  { double time;                                // us
+    unsigned char level;                        // level of DCCIN after the edge
+  } t_edge;
+
+t_edge *edges;
+unsigned long edge_count;
+unsigned long edge_size;
+
+void add_edge(double time, unsigned char level)
+{ if (edge_count == edge_size)
+  { edge_size = edge_size ? edge_size * 2 : 4096;
+    edges = realloc(edges, edge_size * sizeof(t_edge));
+    if (!edges) { fprintf(stderr, "replay: out of memory\n"); exit(1); }
+  }
+  edges[edge_count].time = time;
+  edges[edge_count].level = level;
+  edge_count++;
+}
+
+
+unsigned long read_trace(const char *name)
+{ FILE *f = fopen(name, "r");
+  char line[128];
+  double time;
+  unsigned int level;
+  if (!f) { perror(name); exit(1); }
+  while (fgets(line, sizeof(line), f))
+  { if ((line[0] == '#') || (line[0] == '\n')) continue;
+    if (sscanf(line, "%lf %u", &time, &level) != 2)
+    { fprintf(stderr, "replay: bad line in %s: %s", name, line);
+      exit(1);
+    }
+    add_edge(time, level ? 1 : 0);
+  }
+  fclose(f);
+  return(0);                                    // number of packets in the trace is unknown
+}
+
+
+//*****************************************************************************************************
+// Synthetic traces
+//*****************************************************************************************************
+double gen_time;                                // end of the trace that has been generated
+unsigned char gen_level;                        // level of DCCIN at gen_time
+double gen_jitter;
+unsigned int gen_glitch;                        // per 1000 half-bits
+double gen_loss;                                // ms without track power
+unsigned char gen_invert;
+unsigned int gen_dec_addr = MY_DEC_ADDR;
+unsigned char gen_extended;
+unsigned long gen_acc_mine;                     // accessory commands for our decoder address
+unsigned char gen_repeat;
+unsigned long gen_pom;                          // PoM packets for our loco (each twice with -r)
+
+double random_us(double range)                  // -range .. range
+{ return(((double)rand() / RAND_MAX * 2.0 - 1.0) * range);
+}
+
+void gen_raw(unsigned char level, double duration)
+{ if (level != gen_level)
+  { double time = gen_time + random_us(gen_jitter);
+    if (edge_count && (time <= edges[edge_count - 1].time)) time = edges[edge_count - 1].time + 1.0;
+    add_edge(time, level);
+    gen_level = level;
+  }
+  gen_time += duration;
+}
+
+void gen_half(unsigned char level, double duration)
+{ level ^= gen_invert;
+  if (gen_glitch && ((unsigned int)(rand() % 1000) < gen_glitch))
+  { gen_raw(level, duration / 2);               // a short pulse in the middle
+    gen_raw(!level, 2.0);
+    gen_raw(level, duration / 2 - 2.0);
+  }
+  else gen_raw(level, duration);
+}
+
+void gen_bit(unsigned char bit)
+{ double half = bit ? HALF1 : HALF0;
+  gen_half(1, half);
+  gen_half(0, half);
+}
+
+void gen_cutout(void)
+{ gen_half(1, 29.0);                            // start of the next bit, until TCS
+  gen_raw(1, 464.0 - 29.0);                     // no current: DCCIN high, whatever the wiring
+}
+
+void gen_packet(unsigned char *data, unsigned char size, unsigned char preamble, unsigned char cutout)
+{ unsigned char i, j, xor = 0;
+  if (cutout)
+  { gen_cutout();
+    preamble = (preamble > 4) ? preamble - 4 : 0;
+  }
+  for (i = 0; i < preamble; i++) gen_bit(1);
+  for (i = 0; i <= size; i++)
+  { unsigned char byte = (i < size) ? data[i] : xor;
+    xor ^= byte;
+    gen_bit(0);
+    for (j = 0; j < 8; j++) gen_bit((byte >> (7 - j)) & 1);
+  }
+  gen_bit(1);                                   // end bit
+}
+
+// A mix of traffic as seen on a layout: mostly idle and packets for other decoders
+unsigned char gen_message(unsigned char *data)
+{ unsigned int r = rand() % 100;
+  unsigned int addr;
+  if (r < 40)
+  { data[0] = 0xFF; data[1] = 0x00;             // idle
+    return(2);
+  }
+  if (r < 55)
+  { data[0] = 1 + rand() % 111;                 // 7 bit loco, speed
+    data[1] = 0x60 | (rand() & 0x1F);
+    return(2);
+  }
+  if (r < 75)
+  { do addr = 128 + rand() % 9000; while (addr == MY_LOCO_ADDR);
+    data[0] = 0xC0 | (addr >> 8);               // 14 bit loco, 128 speed steps
+    data[1] = addr & 0xFF;
+    data[2] = 0x3F;
+    data[3] = rand() & 0xFF;
+    return(4);
+  }
+  if ((r < 90) && gen_extended)
+  { do addr = rand() % 0x07FF; while (addr == gen_dec_addr);  // extended accessory, any decoder
+    if (r >= 85) { addr = gen_dec_addr; gen_acc_mine++; }
+    data[0] = 0x80 | ((addr >> 2) & 0x3F);
+    data[1] = ((~addr >> 4) & 0x70) | ((addr & 0x03) << 1) | 0x01;
+    data[2] = rand() & 0x1F;                    // aspect
+    return(3);
+  }
+  if (r < 90)
+  { addr = rand() % 256;                        // basic accessory, any decoder
+    if (r >= 85)
+    { addr = gen_dec_addr + 1;                  // Lenz: wire address = decoder address + 1,
+      if (((addr & 0x3F) == 0) && (addr < 256)) addr -= 64;   // see analyze_accessory_message()
+      gen_acc_mine++;
+    }
+    data[0] = 0x80 | (addr & 0x3F);
+    data[1] = 0x80 | ((~addr >> 2) & 0x70) | 0x08 | (rand() & 0x07);
+    return(2);
+  }
+  if (rand() & 1)
+  { data[0] = 0xC0 | (MY_LOCO_ADDR >> 8);       // our loco address
+    data[1] = MY_LOCO_ADDR & 0xFF;
+    addr = 2;
+  }
+  else
+  { data[0] = MY_SHORT_ADDR;                    // our short loco address
+    addr = 1;
+  }
+  if (r < 93)
+  { data[addr] = 0x80 | (rand() & 0x0F);        // F1..F4
+    return(addr + 1);
+  }
+  if (r < 95)
+  { if (rand() & 1)
+    { data[addr] = 0xA0 | (rand() & 0x1F);      // F5..F8 or F9..F12
+      return(addr + 1);
+    }
+    data[addr] = 0xDE | (rand() & 1);           // F13..F20 or F21..F28
+    data[addr + 1] = rand() & 0xFF;
+    return(addr + 2);
+  }
+  data[addr] = 0xE4;                            // PoM verify CV 1..8 (1..256 with -r, so that
+  data[addr + 1] = gen_repeat ? rand() & 0xFF : rand() % 8;   // pairs are rarely equal)
+  data[addr + 2] = 0;
+  gen_pom++;
+  return(addr + 3);
+}
+
+// Pairs of messages for -r. The partner of a PoM is a speed packet for the same loco,
+// which is interleaved with the PoM like a command station refreshes the loco. The
+// partner of a basic accessory command for us is one for another port of our decoder
+unsigned char gen_pair(unsigned char *data1, unsigned char *size1, unsigned char *data2)
+{ unsigned long pom = gen_pom;
+  unsigned long acc = gen_acc_mine;
+  unsigned char addr;
+  *size1 = gen_message(data1);
+  if ((gen_acc_mine != acc) && !gen_extended)
+  { data2[0] = data1[0];
+    data2[1] = data1[1] ^ 0x02;                 // the next port
+    gen_acc_mine++;
+    return(2);
+  }
+  if (gen_pom == pom) return(gen_message(data2));
+  addr = *size1 - 3;                            // bytes of the loco address
+  memcpy(data2, data1, addr);
+  data2[addr] = 0x60 | (rand() & 0x1F);         // speed, forward
+  return(addr + 1);
+}
+
+unsigned long generate_trace(unsigned long packets, unsigned char preamble, unsigned char cutout)
+{ unsigned char data[MAX_DCC_SIZE];
+  unsigned char pair[2][MAX_DCC_SIZE];
+  unsigned char pair_size[2];
+  unsigned char size;
+  unsigned long i;
+  gen_time = 100.0;
+  gen_level = gen_invert;
+  for (i = 0; i < packets; i++)
+  { if (gen_loss && (i == packets / 2)) gen_raw(1, gen_loss * 1000.0);  // no current: DCCIN high
+    if (gen_extended && ((i == packets / 2) || (i == packets / 2 + 1)))
+    { data[0] = 0xBF;                           // extended broadcast (0x07FF), absolute stop
+      data[1] = 0x07;
+      data[2] = 0x00;
+      size = 3;
+    }
+    else if (gen_repeat)
+    { if ((i & 3) == 0) pair_size[1] = gen_pair(pair[0], &pair_size[0], pair[1]);
+      size = pair_size[i & 1];
+      memcpy(data, pair[i & 1], size);
+    }
+    else size = gen_message(data);
+    gen_packet(data, size, preamble, cutout && i);
+  }
+  gen_raw(!gen_level, 0);                       // the last edge
+  return(packets);
+}
+
+void write_trace(const char *name)
+{ FILE *f = fopen(name, "w");
+  unsigned long i;
+  if (!f) { perror(name); exit(1); }
+  fprintf(f, "# DCCIN edges: <time in us> <level after the edge>\n");
+  for (i = 0; i < edge_count; i++) fprintf(f, "%.2f %u\n", edges[i].time, edges[i].level);
+  fclose(f);
+}
+
+
+//*****************************************************************************************************
+// Emulation of the hardware
+//*****************************************************************************************************
+#define TICK_PERIOD         20000L              // us, as timer1.c
+#define T1_TOP              (F_CPU / 1000000L * TICK_PERIOD / 8)   // as init_timer1()
+#define T0_RUNNING          (TCCR0 & ((1<<CS02) | (1<<CS01) | (1<<CS00)))
+
+double t0_overflow;                             // time of the next Timer0 overflow, < 0: none
+unsigned long cmd_count[8];                     // received messages per CmdType
+unsigned long safe_count;                       // safe states entered
+unsigned char verbose;
+
+void set_time(double time)
+{ unsigned long long ticks = (unsigned long long)(time * (F_CPU / 8) / 1000000.0);
+  TCNT1 = ticks % (ICR1 + 1);
+}
+
+void check_timer0(double time)
+{ if (!T0_RUNNING) t0_overflow = -1.0;
+  else if (t0_overflow < 0) t0_overflow = time + (256 - TCNT0) * 8.0 * 1000000.0 / F_CPU;
+}
+
+void drain_messages(double time)
+{ t_message *msg;
+  unsigned char i;
+  unsigned char safe;
+  while ((msg = dcc_peek_message()))
+  { safe = safe_time;
+    analyze_message(msg);
+    if (!safe && safe_time) safe_count++;
+    cmd_count[CmdType & 7]++;
+    if (verbose)
+    { printf("%12.1f us  cmd %u  repeat %3u  ", time, CmdType, RecRepeat);
+      for (i = 0; i < msg->size; i++) printf(" %02X", msg->dcc[i]);
+      printf("\n");
+    }
+    dcc_release_message();
+  }
+}
+
+void main_tick(double time)
+{ unsigned char present = dcc_presence.present;
+  timerval++;
+  check_repeat_time_out();
+  check_relays_time_out();
+  check_service_mode_time_out();
+  dcc_statistics_tick();
+  dcc_timing_tick();
+  if (dcc_presence.present != present)
+    printf("%12.1f us  DCC signal %s\n", time, dcc_presence.present ? "back" : "lost");
+}
+
+unsigned char int1_triggers(unsigned char old_level, unsigned char new_level)
+{ unsigned char sense = (MCUCR >> ISC10) & 3;
+  if (!(GICR & (1<<INT1))) return(0);
+  if (sense == 1) return(1);                    // any change
+  if (sense == 3) return(new_level && !old_level);
+  return(!new_level && old_level);              // falling edge (or low level)
+}
+
+void replay(void)
+{ unsigned long i;
+  unsigned char level = PIND & (1<<DCCIN) ? 1 : 0;
+  double next_tick = TICK_PERIOD;
+  double time;
+  t0_overflow = -1.0;
+  for (i = 0; i < edge_count; i++)
+  { time = edges[i].time;
+    while (1)
+    { // Handle the Timer0 overflow and the 20ms ticks before this edge, in order
+      if ((t0_overflow >= 0) && (t0_overflow <= time) && (t0_overflow <= next_tick))
+      { double overflow = t0_overflow;
+        set_time(overflow);
+        TIMER0_OVF_vect();
+        t0_overflow = -1.0;
+        check_timer0(overflow);
+        drain_messages(overflow);
+      }
+      else if (next_tick <= time)
+      { main_tick(next_tick);
+        next_tick += TICK_PERIOD;
+      }
+      else break;
+    }
+    if (edges[i].level) PIND |= (1<<DCCIN);
+    else PIND &= ~(1<<DCCIN);
+    if (int1_triggers(level, edges[i].level))
+    { set_time(time);
+      INT1_vect();
+      check_timer0(time);
+      drain_messages(time);
+    }
+    level = edges[i].level;
+  }
+  if (t0_overflow >= 0)                         // the sample of the last bit (J and K swapped)
+  { set_time(t0_overflow);
+    TIMER0_OVF_vect();
+    drain_messages(t0_overflow);
+  }
+}
+
+
+//*****************************************************************************************************
+// Main
+//*****************************************************************************************************
+void usage(void)
+{ fprintf(stderr, "usage: replay [-n packets] [-p preamble] [-j jitter_us] [-g glitch_permille]\n"
+                  "              [-c] [-x] [-l loss_ms] [-s seed] [-o outfile] [-a dec_addr] [-e]\n"
+                  "              [-r] [-b] [-v] [tracefile]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{ unsigned long packets = 10000;
+  unsigned long sent;
+  unsigned char preamble = 14;
+  unsigned char cutout = 0;
+  unsigned char bidi = 0;
+  unsigned int seed = 1;
+  const char *outfile = 0;
+  const char *tracefile = 0;
+  clock_t start;
+  double cpu, duration;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  { if (argv[i][0] != '-') { tracefile = argv[i]; continue; }
+    switch (argv[i][1])
+    { case 'n': if (++i >= argc) usage(); packets = strtoul(argv[i], 0, 10); break;
+      case 'p': if (++i >= argc) usage(); preamble = atoi(argv[i]); break;
+      case 'j': if (++i >= argc) usage(); gen_jitter = atof(argv[i]); break;
+      case 'g': if (++i >= argc) usage(); gen_glitch = atoi(argv[i]); break;
+      case 'l': if (++i >= argc) usage(); gen_loss = atof(argv[i]); break;
+      case 's': if (++i >= argc) usage(); seed = atoi(argv[i]); break;
+      case 'o': if (++i >= argc) usage(); outfile = argv[i]; break;
+      case 'a': if (++i >= argc) usage(); gen_dec_addr = atoi(argv[i]); break;
+      case 'e': gen_extended = 1; break;
+      case 'r': gen_repeat = 1; break;
+      case 'c': cutout = 1; break;
+      case 'x': gen_invert = 1; break;
+      case 'b': bidi = 1; break;
+      case 'v': verbose = 1; break;
+      default:  usage();
+    }
+  }
+
+  // The trace
+  srand(seed);
+  if (tracefile) sent = read_trace(tracefile);
+  else sent = generate_trace(packets, preamble, cutout);
+  if (outfile) write_trace(outfile);
+  if (!edge_count) { fprintf(stderr, "replay: empty trace\n"); return(1); }
+  duration = edges[edge_count - 1].time - edges[0].time;
+
+  // As init_global() and init_timer1()
+  ICR1 = T1_TOP;
+  MyConfig = gen_extended;
+  My_Dec_Addr = gen_dec_addr;
+  My_Loco_Addr = MY_LOCO_ADDR;
+  My_Short_Addr = MY_SHORT_ADDR;
+  CV.BiDi = bidi;
+  my_eeprom_load_cv();
+  if (gen_extended)
+  { MyType = TYPE_RELAYS;
+    CV_RAM.SafeMode |= (1 << 2);                // SAFE_ACCESSORY, see dcc_decode.c
+  }
+  if (edges[0].level) PIND &= ~(1<<DCCIN);      // start with the opposite level
+  else PIND |= (1<<DCCIN);
+  init_dcc_receiver();
+  init_dcc_decode();
+
+  start = clock();
+  replay();
+  cpu = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  // Report
+  printf("receiver:        %s\n", (DCC_RECEIVER_MODE == DCC_RX_SAMPLING) ? "sampling" : "edge capture");
+  printf("trace:           %lu edges, %.3f s\n", edge_count, duration / 1000000.0);
+  if (sent) printf("packets sent:    %lu\n", sent);
+  printf("packets valid:   %u\n", dcc_valid);
+  printf("  idle:          %u\n", dcc_idle);
+  printf("  filtered:      %u\n", dcc_filtered);
+  printf("  to main:       %u\n", dcc_accepted);
+  printf("  ring overflow: %u\n", dcc_ring_overflows);
+  printf("errors:          checksum %u, too long %u, framing %u, preamble %u\n",
+         dcc_errors.checksum, dcc_errors.too_long, dcc_errors.framing, dcc_errors.preamble);
+  if (sent) printf("packets lost:    %ld\n", (long)sent - (long)dcc_valid);
+  if (sent) printf("accessory sent:  %lu for decoder address %u (%s)\n", gen_acc_mine, gen_dec_addr,
+                   gen_extended ? "extended" : "basic");
+  printf("presence:        %s, lost %u times; last window %u packets, %u bits\n",
+         dcc_presence.present ? "present" : "lost", dcc_presence.losses, dcc_presence.packets, dcc_presence.bits);
+  printf("commands:        accessory %lu (other %lu), F0..F4 %lu, F5..F28 %lu, PoM %lu, SM %lu, ignored %lu\n",
+         cmd_count[ACCESSORY_CMD], cmd_count[ANY_ACCESSORY_CMD], cmd_count[LOCO_F0F4_CMD],
+         cmd_count[LOCO_F5F28_CMD], cmd_count[POM_CMD], cmd_count[SM_CMD], cmd_count[IGNORE_CMD]);
+  if (sent && gen_repeat) printf("PoM sent:        %lu, each twice (interleaved)\n", gen_pom);
+  printf("safe state:      entered %lu times\n", safe_count);
+  if (DCC_RECEIVER_MODE == DCC_RX_SAMPLING)
+    printf("sample point:    %u us (margin %u us, half-bits %u / %u us)\n", dcc_timing.sample_point,
+           dcc_timing.margin, dcc_timing.half1, dcc_timing.half0);
+  if (bidi)
+    printf("cutouts:         %u detected, %u compliant, %u missing; last: start %u end %u length %u us\n",
+           dcc_cutout.detected, dcc_cutout.compliant, dcc_cutout.missing,
+           dcc_cutout.start, dcc_cutout.end, dcc_cutout.length);
+  printf("host cpu:        %.3f s, %.0f packets/s\n", cpu, cpu > 0 ? dcc_valid / cpu : 0.0);
+  return(0);
+}
@@ -0,0 +1,16 @@
+//*****************************************************************************************************
+//
+// file:      host/util/delay.h
+// purpose:   Delay shim for host builds: busy waiting is not simulated.
+//
+//*****************************************************************************************************
+#ifndef _UTIL_DELAY_H_
+#define _UTIL_DELAY_H_
+
+#include <stdint.h>
+
+#define _delay_us(us)               do {} while (0)
+#define _delay_ms(ms)               do {} while (0)
+static inline void _delay_loop_2(uint16_t __count) { (void)__count; }
+
+#endif
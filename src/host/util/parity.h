@@ -0,0 +1,12 @@
+//*****************************************************************************************************
+//
+// file:      host/util/parity.h
+// purpose:   Parity shim for host builds
+//
+//*****************************************************************************************************
+#ifndef _HOST_UTIL_PARITY_H_
+#define _HOST_UTIL_PARITY_H_
+
+#define parity_even_bit(val)        __builtin_parity(val)
+
+#endif
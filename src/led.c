@@ -18,6 +18,8 @@
 //                               commands (up to now)
 //            2011-12-31 V0.2 ap Removed everything, except the timer related code
 //            2013-04-03 V0.3 ap Removed everything, except the LED related code
+//            2026-10-16 V0.4    Search blinking (CV23 or a loco function) is not
+//                               interrupted by the feedback and relays flashes
 //
 //------------------------------------------------------------------------
 //
@@ -60,6 +62,8 @@ struct
   unsigned char act_flash;	// Number of flashes thusfar
 } led;
 
+unsigned char led_search;	// Search blinking requested by (LED_SEARCH_CV23, LED_SEARCH_FUNC)
+
 
 void turn_led_on(void) {
   led.mode = ALWAYS_ON;
@@ -73,6 +77,7 @@ void turn_led_off(void) {
 
 // Single short flash, to indicate a RS-Bus feedback
 void feedback_led(void) {
+  if (led_search) return;			// do not interrupt the search blinking
   led.mode = FLASH_ONCE;			// single flash
   led.rest    = 80000L / TICK_PERIOD;		// 0,08 sec
   LED_ON;
@@ -81,6 +86,7 @@ void feedback_led(void) {
 
 // Single very short flash, to indicate a relays command
 void relays_led(void) {
+  if (led_search) return;			// do not interrupt the search blinking
   led.mode = FLASH_ONCE;			// single flash
   led.rest    = 40000L / TICK_PERIOD;		// 0,08 sec
   LED_ON;
@@ -100,6 +106,19 @@ void flash_led_fast(unsigned char count) {
 }
 
 
+// Search blinking: the LED blinks while at least one source (CV23 or a loco function) is on
+void search_led(unsigned char source, unsigned char on) {
+  if (on) {
+    if (!led_search) flash_led_fast(8);
+    led_search |= source;
+  }
+  else if (led_search & source) {
+    led_search &= ~source;
+    if (!led_search) turn_led_off();
+  }
+}
+
+
 // the next function will be called from main every 20 seconds
 void check_led_time_out(void) {
   if (led.mode == ALWAYS_ON) return;
@@ -35,6 +35,11 @@ void relays_led(void);
   
 void flash_led_fast(unsigned char count);
 
+// Sources of the search blinking
+#define LED_SEARCH_CV23   0x01
+#define LED_SEARCH_FUNC   0x02
+void search_led(unsigned char source, unsigned char on);
+
 void check_led_time_out(void);
 
 
@@ -117,6 +117,7 @@ void WaitDebounceTime(void) {
 
 void DoProgramming(void) {
   unsigned int GlobalPortAddr;
+  t_message *msg;
   int Ticks_Waited = 0;
   WaitDebounceTime();                           // Busy wait debouncing time, for stable button pushed
   if (PROG_PRESSED) {                           // only act if key is still pressed after 100 ms
@@ -127,9 +128,12 @@ void DoProgramming(void) {
     }
     if (Ticks_Waited <= 50) {                   // button is released within 5 sec => programme address
       WaitDebounceTime();                       // Busy wait debouncing time, for stable button release
+      dcc_filter.enabled = 0;                   // we need accessory commands for any address
       while(!PROG_PRESSED) {
-        if (semaphor_get(C_Received)) {         // Message
-          analyze_message(&incoming);
+        msg = dcc_peek_message();
+        if (msg) {                              // Message
+          analyze_message(msg);
+          dcc_release_message();
           // CmdType == ANY_ACCESSORY_CMD => Accessory command but not for my current address 
           // CmdType == ACCESSORY_CMD     => Accessory command for my current address 
           if ((CmdType == ACCESSORY_CMD) || (CmdType == ANY_ACCESSORY_CMD)){
@@ -158,13 +162,16 @@ void DoProgramming(void) {
 //********************************* Initialisation of global variables ********************************
 //*****************************************************************************************************
 void init_global(void)
-{ // Step 1: Determine the RS-Bus address. The valid range is 1..128
+{ // Step 0: Copy the CVs from EEPROM to SRAM. All other init functions depend on this
+  my_eeprom_load_cv();
+  // Step 1: Determine the RS-Bus address. The valid range is 1..128
   // It can be 0, however, if the myRSAddr CV has not been initialised yet
   // In that case it can later be initialised via a PoM message
   My_RS_Addr = my_eeprom_read_byte(&CV.MyRsAddr);
   if (My_RS_Addr > 128) {My_RS_Addr = 0;}
   // Step 2: Determine the kind of accessory decoder addressing we react upon
-  MyConfig = my_eeprom_read_byte(&CV.Config) & (1<<6);  // (0=basic, 1=extended)
+  // CV29 bit 5 (see cv_data_gbm.h) is the decoder type
+  MyConfig = (my_eeprom_read_byte(&CV.Config) & (1<<5)) ? 1 : 0;  // (0=basic, 1=extended)
   // Step 3: Determine the decoder type
   // Will b one of the following: TYPE_NORMAL, TYPE_REVERSER, TYPE_RELAYS or TYPE_SPEED
   MyType = my_eeprom_read_byte(&CV.DecType);
@@ -183,13 +190,20 @@ void init_global(void)
   if (MyConfig != 1) My_Dec_Addr = (cv9 << 6) + cv1 - 1;	// Basic Acc. Addressing
   else My_Dec_Addr = (cv9 << 8) + cv1 - 1;			// Extended Acc. Addressing
   // The valid range of My_Dec_Addr is 0..511 (0..255 if Xpressnet is used).
+  // For extended accessory decoders, CV1 is 0..255 and the range is 0..2046 (2047 is broadcast)
   // Note that My_Dec_Addr will be 0 if the decoder has not been initialised  
-  if ((cv1 > 63)) My_Dec_Addr = INVALID_DEC_ADR;
-  if (My_Dec_Addr > 511) My_Dec_Addr = INVALID_DEC_ADR;
+  if (MyConfig != 1) {
+    if ((cv1 > 63)) My_Dec_Addr = INVALID_DEC_ADR;
+    if (My_Dec_Addr > 511) My_Dec_Addr = INVALID_DEC_ADR;
+  }
+  else if (My_Dec_Addr > 2046) My_Dec_Addr = INVALID_DEC_ADR;
   if (my_eeprom_read_byte(&CV.myAddrH) & 0x80) My_Dec_Addr = INVALID_DEC_ADR;
   // Step 5: Determine the address for (Loco) PoM messages. Use My_RS_Addr
   My_Loco_Addr = My_RS_Addr + LOCO_OFFSET;
   if (My_Loco_Addr > (128 + LOCO_OFFSET)) {My_Loco_Addr = LOCO_OFFSET;}
+  // Optional short loco address for the same purpose (0 = not used)
+  My_Short_Addr = my_eeprom_read_byte(&CV.ShortAddr);
+  if (My_Short_Addr > 127) {My_Short_Addr = 0;}
   // Step 6: Initialise global variables
   CmdType = IGNORE_CMD;
 }
@@ -200,6 +214,7 @@ void init_global(void)
 //*****************************************************************************************************
 int main(void)
   {
+    t_message *msg;
     init_hardware();			   // setup hardware ports
     init_global();			     // initialise the global variables
 
@@ -226,29 +241,40 @@ int main(void)
       ResetDecoder();                             // Copy all default values to EEPROM
       _restart();                                 // really hard exit
     }
+    // The EEPROM may also be of an older software version. The CVs that are new since
+    // then have not been initialised (0xFF)
+    if (my_eeprom_read_byte(&CV.version) < pgm_read_byte(&CV_PRESET.version)) {
+      UpgradeDecoder();                           // Copy the default values of the new CVs
+      _restart();
+    }
 
     // check if the decoder has a valid RS-BUS address
     if ((My_RS_Addr == 0) || (My_RS_Addr > 128)) flash_led_fast(5);
     
     while(1) {
       if (PROG_PRESSED) DoProgramming();
-      if (semaphor_query(C_Received)) {	// DCC message received
-        analyze_message(&incoming);
+      while ((msg = dcc_peek_message())) {	// drain all received DCC messages
+        analyze_message(msg);
         if (CmdType >= 1) {   
           if (CmdType == ANY_ACCESSORY_CMD) {;}
-          if (CmdType == ACCESSORY_CMD)	{set_relay();}
+          if (CmdType == ACCESSORY_CMD)	{if (MyConfig) set_aspect(); else set_relay();}
           if (CmdType == LOCO_F0F4_CMD)	{set_relay();}
+          if (CmdType == LOCO_F5F28_CMD) {set_functions();}
           if (CmdType == POM_CMD)	      {cv_operation(POM_CMD);}
           if (CmdType == SM_CMD) 	      {cv_operation(SM_CMD);}
         }
-        semaphor_get(C_Received);	// now take away the protection
+        dcc_release_message();		// the ISR may now reuse this slot
       }
-      detect_occupied_tracks();		// prepare new AD conversion (runs every 1ms)
+      detect_occupied_tracks();		// evaluate the new ADC samples (taken by the ADC ISR)
       if (timer1fired) {		// 1 time tick (20ms) has passed)
         handle_occupied_tracks();	// if track occupance changed, send RS-bus message / set reverser relays
         check_led_time_out();
         check_relays_time_out();
-        check_PoM_time_out();
+        check_repeat_time_out();
+        check_service_mode_time_out();
+        dcc_statistics_tick();
+        dcc_timing_tick();
+        save_calibration_tick();	// write the result of a calibration, one CV per tick
         timer1fired = 0;
         // Step 3: check actions for both of our Speed Measurement Tracks
         if (MyType == TYPE_SPEED) {check_speed_tracks();}
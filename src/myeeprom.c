@@ -4,15 +4,31 @@
 #include <avr/pgmspace.h>        // put var to program memory
 #include <avr/io.h>
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
+
+#include "config.h"              // CV and CV_RAM
+#include "myeeprom.h"
+
+// Addresses within the first CV_RAM_SIZE bytes of the CV record are also available in CV_RAM
+#define CV_FIRST   ((const uint8_t *) &CV)
+#define IN_CV(p)   (((p) >= CV_FIRST) && ((p) < CV_FIRST + CV_RAM_SIZE))
+
 
 void my_eeprom_write_byte(uint8_t *__p, uint8_t __value)
   {
+    if (IN_CV(__p)) ((uint8_t *) &CV_RAM)[__p - CV_FIRST] = __value;
     eeprom_write_byte(__p, __value);
   }
 
 
 uint8_t my_eeprom_read_byte(const uint8_t *__p)
   {
+    if (IN_CV(__p)) return(((const uint8_t *) &CV_RAM)[__p - CV_FIRST]);
     return(eeprom_read_byte(__p));
   }
 
+
+void my_eeprom_load_cv(void)
+  {
+    eeprom_read_block(cv_ram, &CV, CV_RAM_SIZE);
+  }
@@ -3,6 +3,12 @@
 
 // this is only a wrapper to prevent inlining from gcc
 // this reduces code size dramatically!!
+//
+// The CV record (CV) is also kept in SRAM (CV_RAM, see config.c), up to CV124
+// (CV_RAM_SIZE). Reads within that part are served from SRAM; writes go to EEPROM
+// and SRAM (write-through). The CVs from CV125 on are read from EEPROM.
+// Code that runs often may read CV_RAM directly. CV_RAM must not be written
+// directly, since the EEPROM would then no longer match.
 
 uint8_t my_eeprom_read_byte(const uint8_t *__p);
 
@@ -10,4 +16,7 @@ uint8_t my_eeprom_read_byte(const uint8_t *__p);
 void my_eeprom_write_byte(uint8_t *__p, uint8_t __value);
 
 
+void my_eeprom_load_cv(void);       // copy CV to CV_RAM; must be called first at startup
+
+
 #endif
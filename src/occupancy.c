@@ -11,6 +11,8 @@
 // history:   2010-11-10 V0.1 Initial version
 //            2011-02-06 V0.2 First complete production version
 //            2013-04-20 V0.3 All ADC code removed. Generalized to allow reversers
+//            2026-10-16 V0.4 Feedback bit for "DCC signal lost" (CV PowerFB)
+//            2026-10-16 V0.5 Feedback bits as masks; the map is a precomputed bit permutation
 //
 // This code can be used to send feedback information from decoder to master station via
 // the RS-bus. This code implements the datalink layer routines (define the byte contents).
@@ -25,9 +27,15 @@
 // - set_all_relays() will be called to set the reverser relays 
 //
 // Input data used:
-// Reads adc_result[8], which is maintained within adc_hardware,c
-// - is_on  == 1: Track is certainly occupied by train (spikes have already been filtered) 
-// - is_off == 1: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// Reads the masks adc_on and adc_off, which are maintained within adc_hardware,c (bit i is ADC pin i)
+// - adc_on:  Track is certainly occupied by train (spikes have already been filtered) 
+// - adc_off: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// The feedback bits are handled as masks as well (bit i is feedback bit i). The ADC input pins are
+// mapped upon the feedback bits with two tables of 16 entries, one per nibble of the ADC mask; only
+// if the masks have changed (adc_generation) the mapping is done again.
+// After the DCC signal is lost, the channels are stale: neither on nor off, so the occupancy
+// that was reported last does not change, and the reverser does not switch.
+// If CV PowerFB is set, that feedback bit reports whether the DCC signal is lost (dcc_presence)
 //
 //************************************************************************************************
 
@@ -47,7 +55,7 @@
 #include "hardware.h"		// port definitions for target
 #include "dcc_receiver.h"	// hardware related DCC functions (layer 1 / physical layer)
 #include "led.h"                // LED specific functions
-#include "adc_hardware.h"       // for reading values from the struct array adc_result
+#include "adc_hardware.h"       // for reading the adc_on and adc_off masks
 #include "rs_bus_hardware.h"	// hardware related RS-bus functions (layer 1 / physical layer)
 #include "rs_bus_messages.h"    // for sending RS-bus nibbles via format_and_send_RS_data_nibble() 
 #include "timer1.h"       	// for start_up_phase() and time_for_next_feedback() 
@@ -80,32 +88,47 @@
 //************************************************************************************************
 // Define "global" variables for within this file
 //************************************************************************************************
-struct
-{
-  unsigned char should_be_on;    	 // according to our hardware the bit should be on
-  unsigned char should_be_off;    	 // according to our hardware the bit should be off
-  unsigned char previous_transmitted;    // this position has previously been send to the master
-  unsigned char next_to_transmit;        // this position will be send next to the master
-  unsigned char number_of_transmissions; // 0: nothing needs to be send anymore
+// We have eight feedback signals; bit i of each mask is feedback bit i
+unsigned char should_be_on;		 // according to our hardware the bit should be on
+unsigned char should_be_off;		 // according to our hardware the bit should be off
+unsigned char previous_transmitted;	 // these values have previously been send to the master
+unsigned char next_to_transmit;		 // these values will be send next to the master
+unsigned char number_of_transmissions[8];// 0: nothing needs to be send anymore
   					 // >1: info needs to be send / Note: a higher value is
  					 // used to transmit multiple times (forward error correction)
-} feedback[8];                  	 // we have eight feedback signals
 
-// The following array is used to map to adc pins to RS-Bus feedback bits (needed since we have sensor tracks)
-unsigned char map[8];			 // Note that multiple adc pins may map upon the same feedback bit
+// The following tables map the adc pins to RS-Bus feedback bits (needed since we have sensor tracks)
+// map_low[n]: feedback bits of the adc pins 0..3 in mask n; map_high[n]: the same for adc pins 4..7
+unsigned char map_low[16];		 // Note that multiple adc pins may map upon the same feedback bit
+unsigned char map_high[16];
+#define MAP_PINS(pins)  (map_low[(pins) & 0x0F] | map_high[(pins) >> 4])
+
+// The sensor tracks of the reverser (ADC input pins)
+#define SENSORS_1_2     ((1 << 1) | (1 << 2))	// Sensor 1 and 2: set the relays to 1
+#define SENSORS_3_4     ((1 << 4) | (1 << 5))	// Sensor 3 and 4: set the relays to 0
+
+unsigned char Seen_Generation;	// adc_generation at the previous mapping
+unsigned char Seen_Present;	// dcc_presence.present at the previous mapping
 
 // The following variable is initialised from CV RSRetry
 unsigned char RS_tranmissions;	// Number of times a RS-bus message is transmitted
 
+// The following variable is initialised from CV PowerFB
+unsigned char Power_FB;		// Feedback bit (1..8) that is 1 while the DCC signal is lost. 0: not used
+
 
 //************************************************************************************************
 // init_occupancy will be directly called from main externally
 //************************************************************************************************
 void init_occupancy(void) {
+  unsigned char map[8];		// Feedback bit of each ADC input pin
+  unsigned char i, n;
   // Step 1: Determine number of times the same RS-feedback nibble will be transmitted
   // Minimum is 1, but if CV.RSRetry > 0 the nibble will be retransmitted (forward error correction)
   RS_tranmissions = 1 + my_eeprom_read_byte(&CV.RSRetry);   
   if (RS_tranmissions > 3 ) {RS_tranmissions = 3;}
+  Power_FB = my_eeprom_read_byte(&CV.PowerFB);
+  if (Power_FB > 8) {Power_FB = 0;}
   // Step 2: initialise the mapping between the 8 ADC input pins and the 8 feedback bits 
   if (MyType == TYPE_REVERSER) {
     map[0] = my_eeprom_read_byte(&CV.FB_A);	// Track A
@@ -127,50 +150,61 @@ void init_occupancy(void) {
     map[6] = 6;
     map[7] = 7;
   }
+  // Step 3: precompute the mapping of each nibble of ADC input pins
+  for (n = 0; n < 16; n++) {
+    map_low[n] = 0;
+    map_high[n] = 0;
+    for (i = 0; i < 4; i++) {
+      if (n & (1 << i)) {
+        map_low[n]  |= 1 << (map[i] & 7);
+        map_high[n] |= 1 << (map[i + 4] & 7);
+      }
+    }
+  }
+  Seen_Generation = adc_generation - 1;		// map at the first call
 }
 
 
 //************************************************************************************************
-// Step 2A: check the ADC output (adc_result) if any action is needed
+// Step 2A: check the ADC output (adc_on, adc_off) if any action is needed
 //************************************************************************************************
 void analyse_track_occupation(void) {
   // Is called by handle_occupied_tracks, and acts as interface between the 
   // ADC specific code and the RS-bus code
-  unsigned char i;	   // for loop counter for adc_result[8] and feedback[8]
-  unsigned char previous;  // Technically not needed, but makes reading easier
+  unsigned char power;	   // Power feedback bit (mask)
+  unsigned char changed;   // feedback bits that changed since the last transmission
+  unsigned char i;	   // for loop counter for number_of_transmissions[8]
   // Step 1: Reverser actions
   if (MyType == TYPE_REVERSER) {
     // sensor track 1 and / or 2 is occupied
-    if ((adc_result[1].is_on) || (adc_result[2].is_on)) set_all_relays(1);
-    if ((adc_result[4].is_on) || (adc_result[5].is_on)) set_all_relays(0);
+    if (adc_on & SENSORS_1_2) set_all_relays(1);
+    if (adc_on & SENSORS_3_4) set_all_relays(0);
     } 
-  // Step 2: RS-Bus actions.  
-  // Step 2A: ititialise for all feedback bits the "soll" value
-  for (i = 0; i < 8; i++) {
-    feedback[i].should_be_on = 0;	// initial value: no track occupied
-    feedback[i].should_be_off = 1;	// initial value: all tracks free
-  }
-  // Step 2B: set for each ADC input pin the corresponding feedback bit. 
-  // Multiple input pins may be mapped upon the same feedback bit
-  for (i = 0; i < 8; i++) {
-    // if one of the tracks associated with this feedback bit is occupied, this bit should become 1
-    if (adc_result[i].is_on > 0) {feedback[map[i]].should_be_on = 1;}
+  // Step 2: RS-Bus actions. The feedback bits are only mapped again if the ADC masks (generation)
+  // or the DCC signal changed
+  if ((adc_generation != Seen_Generation) || (dcc_presence.present != Seen_Present)) {
+    Seen_Generation = adc_generation;
+    Seen_Present = dcc_presence.present;
+    // Step 2A: set for each ADC input pin the corresponding feedback bit. 
+    // Multiple input pins may be mapped upon the same feedback bit:
+    // if one of the tracks associated with this feedback bit is occupied, this bit should become 1;
     // if one of the tracks associated with this feedback bit is not free, this bit should become 0
-    if (adc_result[i].is_off == 0) {feedback[map[i]].should_be_off = 0;}
+    should_be_on = MAP_PINS(adc_on);
+    should_be_off = ~MAP_PINS((unsigned char) ~adc_off);
+    // Step 2B: The power feedback bit overrides the ADC input pins that may be mapped upon it
+    if (Power_FB) {
+      power = 1 << (Power_FB - 1);
+      if (dcc_presence.present) {should_be_on &= ~power; should_be_off |= power;}
+      else {should_be_on |= power; should_be_off &= ~power;}
+    }
   }
   // Step 2C: Check for each RS-Bus feedback bit if RS-Bus action is needed
-  for (i = 0; i < 8; i++) {
-    previous = feedback[i].previous_transmitted;
-    if (feedback[i].should_be_on && (previous == 0)) {
-      // change detected: is now on
-      feedback[i].next_to_transmit = 1;
-      feedback[i].number_of_transmissions = RS_tranmissions;
-    }
-    if (feedback[i].should_be_off && (previous != 0)) {
-      // change detected: is now off
-      feedback[i].next_to_transmit = 0;
-      feedback[i].number_of_transmissions = RS_tranmissions;
-    }
+  // changes: is now on (but was off), or is now off (but was on)
+  changed = (should_be_on & ~previous_transmitted) | (should_be_off & previous_transmitted);
+  if (changed) {
+    next_to_transmit = (next_to_transmit & ~changed) | (should_be_on & changed);
+    for (i = 0; i < 8; i++)
+      if (changed & (1 << i)) number_of_transmissions[i] = RS_tranmissions;
   }
 }
 
@@ -182,9 +216,22 @@ void save_changes(unsigned char start, unsigned char end) {
   // This function saves the changes for the feedbacks between "start" and "end"
   // after the nibble to which they belong has been send to the master
   unsigned char i;
+  unsigned char mask = 0;
   for (i = start; i <= end; i++) { 
-    feedback[i].previous_transmitted = feedback[i].next_to_transmit;
-    if (feedback[i].number_of_transmissions > 0)   {feedback[i].number_of_transmissions --;} }
+    mask |= (1 << i);
+    if (number_of_transmissions[i] > 0)   {number_of_transmissions[i] --;} }
+  previous_transmitted = (previous_transmitted & ~mask) | (next_to_transmit & mask);
+}
+
+
+//************************************************************************************************
+// The RS-bus data bits of 4 feedback bits (bit 0..3 of fb)
+//************************************************************************************************
+unsigned char data_bits(unsigned char fb) {
+  return(((fb & 0x01) << (DATA_0 - 0))
+       | ((fb & 0x02) << (DATA_1 - 1))
+       | ((fb & 0x04) << (DATA_2 - 2))
+       | ((fb & 0x08) << (DATA_3 - 3)));
 }
 
 
@@ -204,20 +251,14 @@ void RS_connect(void) {
     // send first nibble
     while (RS_data2send_flag) {};	// busy wait, till the USART ISR has send previous data
     RS_Addr2Use = My_RS_Addr;
-    nibble = (feedback[0].next_to_transmit<<DATA_0)
-           | (feedback[1].next_to_transmit<<DATA_1)
-           | (feedback[2].next_to_transmit<<DATA_2)
-           | (feedback[3].next_to_transmit<<DATA_3)
+    nibble = data_bits(next_to_transmit)
            | (0<<NIBBLE);
     save_changes(0,3);
     format_and_send_RS_data_nibble(nibble);      
     // send second nibble
     while (RS_data2send_flag) {};	// busy wait, till the USART ISR has send previous data
     RS_Addr2Use = My_RS_Addr;
-    nibble = (feedback[4].next_to_transmit<<DATA_0)
-           | (feedback[5].next_to_transmit<<DATA_1)
-           | (feedback[6].next_to_transmit<<DATA_2)
-           | (feedback[7].next_to_transmit<<DATA_3)
+    nibble = data_bits(next_to_transmit >> 4)
            | (1<<NIBBLE);             
     save_changes(4,7);
     format_and_send_RS_data_nibble(nibble);
@@ -235,7 +276,7 @@ unsigned char send_needed(unsigned char start, unsigned char end) {
   unsigned char i, result;
   result = 0;                         // initial assumption: no feedback signal has changed
   for (i = start; i <= end; i++) {    // does this assumption hold for all feedback signals?
-    if (feedback[i].number_of_transmissions > 0) {result = 1;} }
+    if (number_of_transmissions[i] > 0) {result = 1;} }
   return result;
 }
 
@@ -252,10 +293,7 @@ void send_feedbacks(void)
     if (send_needed(0,3)) 
     {
       RS_Addr2Use = My_RS_Addr;
-      nibble = (feedback[0].next_to_transmit<<DATA_0)
-      | (feedback[1].next_to_transmit<<DATA_1)
-      | (feedback[2].next_to_transmit<<DATA_2)
-      | (feedback[3].next_to_transmit<<DATA_3)
+      nibble = data_bits(next_to_transmit)
       | (0<<NIBBLE);
       save_changes(0,3);
       format_and_send_RS_data_nibble(nibble);
@@ -263,10 +301,7 @@ void send_feedbacks(void)
     else if (send_needed(4,7))
     {
       RS_Addr2Use = My_RS_Addr;
-      nibble = (feedback[4].next_to_transmit<<DATA_0)
-      | (feedback[5].next_to_transmit<<DATA_1)
-      | (feedback[6].next_to_transmit<<DATA_2)
-      | (feedback[7].next_to_transmit<<DATA_3)
+      nibble = data_bits(next_to_transmit >> 4)
       | (1<<NIBBLE);             
       save_changes(4,7);
       format_and_send_RS_data_nibble(nibble);
@@ -282,7 +317,7 @@ void handle_occupied_tracks(void) {
   // Is called from main every 20 ms
   if (time_for_next_feedback()) {
     // around 40 ms have passed since we tried to send a message
-    // Step 1: check the ADC output (adc_result) if any action is needed
+    // Step 1: check the ADC output (adc_on, adc_off) if any action is needed
     // Possible actions include: 
     // - preparation of RS-bus messages (not sending!) 
     // - setting Reverser relays
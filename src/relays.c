@@ -12,6 +12,9 @@
 // file:      relays.c
 // author:    Aiko Pras
 // history:   2012-01-08 V0.1 ap based upon port_engine.c from the OpenDecoder2 project
+//            2026-10-16 V0.2    Loco functions F5..F28 mapped to relays and actions (CV54..CV77)
+//            2026-10-16 V0.3    Extended accessory aspects mapped to relays patterns (CV78..CV109)
+//            2026-10-16 V0.4    Safe state after a broadcast (emergency) stop (CV122, CV123)
 //
 //
 // A DCC Feedback Decoder for ATmega16A and other AVR. The decoder also supports switching four relays 
@@ -27,6 +30,12 @@
 //   For normal switch / relays4 decoders, the range will be 0..3
 // - TargetGate: Targetted coil within that Port. Usually + or - / green or red
 // - TargetActivate: Coil activation (value = 1) or deactivation (value = 0) 
+// - RecFuncBase, RecFuncState, RecFuncChanged: a group of loco functions F5..F28
+// - RecDecPort: the aspect (0..31) of an extended accessory command
+//
+// After a broadcast stop (see dcc_decode.c), set_safe_state() is called directly from the decoder.
+// All coils drop, and the relays go to the positions of CV SafePattern. The safe state holds for
+// SAFE_HOLD_TIME after the last stop packet; in the meantime, all other commands are ignored.
 
 //*****************************************************************************************************
 
@@ -53,6 +62,15 @@
 #define GREEN 	          1     // The green coil 
 #define UNKNOWN           2     // If we start up and do not know the position before power-down
 
+// Actions for the loco functions F5..F28 (CV FuncMap)
+#define FUNC_NONE         0     // No action
+#define FUNC_RELAY1       1     // Relays 1..4: function on = GREEN, off = RED
+#define FUNC_RELAY4       4
+#define FUNC_ALL_RELAYS   5     // All relays (reverser polarity): on = GREEN, off = RED
+#define FUNC_LED_SEARCH   6     // Decoder LED blinks while the function is on (like CV23)
+
+#define SAFE_HOLD_TIME   50     // Safe state holds 1 s (in 20 ms ticks) after the last stop packet
+
 
 typedef struct {
   unsigned char gate_pos;	// which of the two gates is currently on (RED or GREEN)
@@ -62,6 +80,8 @@ typedef struct {
 
 t_device devices[4];		// we have 4 devices (switches, relays, ...) with each two coils  
 
+unsigned char safe_time;	// remaining time of the safe state (in 20 ms ticks), 0: not safe
+
 
 //*****************************************************************************************************
 //********************************** Local functions (called locally) *********************************
@@ -125,6 +145,7 @@ void set_relay(void) {
   // This function is called from main, after a DCC accessory decoder command  
   // or a loco F1..F4 command is received
   // We do timer-based de-activation, so no need to react on de-activation messages 
+  if (safe_time) return;
   if (TargetActivate) {
     // Only react if the current gate position is different from the requested position
     if (devices[TargetDevice].gate_pos != TargetGate) {
@@ -143,11 +164,83 @@ void set_relay(void) {
 } 
 
 
+void set_functions(void) {
+  // This function is called from main, after a loco command for F5..F28 is received
+  // All functions that changed in the packet are handled; the relays that change are
+  // switched with a single write to RELAYS_PORT
+  unsigned char i;
+  unsigned char on;
+  unsigned char device;
+  unsigned char clear = 0;	// gates (coils) to switch off
+  unsigned char set = 0;	// gates (coils) to switch on
+  if (safe_time) return;
+  for (i = 0; i < 8; i++) {
+    if (!(RecFuncChanged & (1<<i))) continue;
+    on = (RecFuncState >> i) & 1;
+    switch (CV_RAM.FuncMap[RecFuncBase - 5 + i]) {
+      case FUNC_RELAY1 ... FUNC_RELAY4:
+        device = CV_RAM.FuncMap[RecFuncBase - 5 + i] - FUNC_RELAY1;
+        if (devices[device].gate_pos != on) {
+          devices[device].gate_pos = on;
+          devices[device].rest_time = devices[device].hold_time;
+          clear |= (0b11<<(2*device));
+          set &= ~(0b11<<(2*device));
+          set |= (1<<(2*device + on));
+        }
+        break;
+      case FUNC_ALL_RELAYS:
+        set_all_relays(on);
+        break;
+      case FUNC_LED_SEARCH:
+        search_led(LED_SEARCH_FUNC, on);
+        break;
+      default:
+        break;
+    }
+  }
+  if (clear) {
+    relays_led();
+    RELAYS_PORT = (RELAYS_PORT & ~clear) | set;
+  }
+}
+
+
+void set_aspect(void) {
+  // This function is called from main, after an extended accessory command (aspect) is received
+  // The aspect selects a RELAYS_PORT pattern (CV AspectMap). For each relays, bit 2n is the RED
+  // and bit 2n+1 the GREEN coil. Relays with exactly one coil set in the pattern are switched
+  // (if not already in that position), all with a single write to RELAYS_PORT
+  unsigned char pattern = CV_RAM.AspectMap[RecDecPort & 0b00011111];
+  unsigned char i;
+  unsigned char coils;
+  unsigned char pos;
+  unsigned char clear = 0;	// gates (coils) to switch off
+  unsigned char set = 0;	// gates (coils) to switch on
+  if (safe_time) return;
+  for (i = 0; i < 4; i++) {
+    coils = (pattern >> (2*i)) & 0b11;
+    if ((coils != 0b01) && (coils != 0b10)) continue;
+    pos = (coils == 0b10) ? GREEN : RED;
+    if (devices[i].gate_pos != pos) {
+      devices[i].gate_pos = pos;
+      devices[i].rest_time = devices[i].hold_time;
+      clear |= (0b11<<(2*i));
+      set |= (coils<<(2*i));
+    }
+  }
+  if (clear) {
+    relays_led();
+    RELAYS_PORT = (RELAYS_PORT & ~clear) | set;
+  }
+}
+
+
 void set_all_relays(unsigned char pos) {
   // This function is called from occupancy, after an occupied sensor track has been detected
   unsigned char i;
+  if (safe_time) return;
   // Do we need to change polarization?
-  if (my_eeprom_read_byte(&CV.Polarization)) {
+  if (CV_RAM.Polarization) {
     if (pos) pos = 0;
     else pos = 1;
   }
@@ -169,10 +262,40 @@ void set_all_relays(unsigned char pos) {
 }
 
 
+void set_safe_state(void) {
+  // This function is called from the DCC decoder (dcc_decode.c), for every broadcast stop
+  // packet that is enabled in CV SafeMode. The relays port is written at once: the coils that 
+  // are active drop, and the relays go to their safe position (CV SafePattern, coded as
+  // AspectMap). A relays with none or both coils set in the pattern is only switched off.
+  // Repeated stop packets only extend the safe state.
+  unsigned char pattern = CV_RAM.SafePattern;
+  unsigned char i;
+  unsigned char coils;
+  if ((MyType != TYPE_REVERSER) && (MyType != TYPE_RELAYS)) return;	// relays not used
+  if (safe_time) {safe_time = SAFE_HOLD_TIME; return;}
+  safe_time = SAFE_HOLD_TIME;
+  for (i = 0; i < 4; i++) {
+    coils = (pattern >> (2*i)) & 0b11;
+    if ((coils == 0b01) || (coils == 0b10)) {
+      devices[i].gate_pos = (coils == 0b10) ? GREEN : RED;
+      devices[i].rest_time = devices[i].hold_time;
+    }
+    else {
+      pattern &= ~(0b11<<(2*i));
+      if (devices[i].rest_time) devices[i].gate_pos = UNKNOWN;	// pulse cut short
+      devices[i].rest_time = 0;
+    }
+  }
+  RELAYS_PORT = pattern;
+  relays_led();
+}
+
+
 void check_relays_time_out(void) { 
   // This function is called from main, every time tick (20 ms)  
   unsigned char i;
   unsigned char rest_ticks;
+  if (safe_time) safe_time--;
   for (i=0; i<4; i++) {			// check each device (relays, switch, ...)
     rest_ticks = devices[i].rest_time;	// use a local variable to force compiler to tiny code
     if (rest_ticks !=0) {		// coil is active / active time is not over yet
@@ -12,7 +12,10 @@
 
 void init_relays(void);				// called from main
 void set_relay(void);				// called from main 
+void set_functions(void);			// called from main (F5..F28)
+void set_aspect(void);				// called from main (extended accessory)
 void set_all_relays(unsigned char pos);		// called from occupancy
+void set_safe_state(void);			// called from dcc_decode (broadcast stop)
 void check_relays_time_out(void);		// called from main
 
 #endif
@@ -10,6 +10,7 @@
 //
 // history:   2010-11-10 V0.1 Initial version
 //            2011-02-06 V0.2 First complete production version
+//            2026-10-16 V0.3 The Timer 2 ISR requests the AD conversions (every 2 ms)
 //
 //------------------------------------------------------------------------
 
@@ -29,6 +30,7 @@
 
 #include "main.h"
 #include "rs_bus_hardware.h"
+#include "dcc_receiver.h"        // new_adc_requested
 
 //--------------------------------------------------------------------------------------
 //
@@ -205,6 +207,12 @@ ISR(TC2_Compare_Match_Vect)
   // to synchronize their variables.
   TCNT2 = 0;				// Reset counter 2 (this counter)
   T_Sample ++;				// Interval (in ms) between successive AD conversions (used in adc_hardware.c)
+  if (T_Sample >= 2) {			// Request the next AD conversion; the DCC ISR starts it, and the
+    T_Sample = 0;			// ADC ISR stores the result (see adc_hardware.c)
+    // Not while the ADC is busy or its interrupt is pending: the DCC ISR sets ADSC with a
+    // read-modify-write of ADCSRA, which would clear ADIF and lose the result
+    if (!(ADCSRA & ((1 << ADSC) | (1 << ADIF)))) new_adc_requested = 1;
+  }
   T_DelayOff ++;			// Interval used for delaying delay_off messages (which goes in steps of 10ms)
   T_RS_Inactive ++;			// Counter to determine if the RS-bus master is inactive / resets
   T_RS_Idle ++;				// Time since last RS-bus transition  
@@ -20,7 +20,7 @@ volatile unsigned char RS_Layer_2_connected; // Flag to signal slave must connec
 volatile unsigned char RS_data2send_flag;    // Flag that this feedback module wants to send data
 volatile unsigned char RS_data2send;         // Actual data byte that will be send over the RS-bus
 
-volatile unsigned char T_Sample;             // Used by adc_hardware as interval between AD conversions
+volatile unsigned char T_Sample;             // Interval between AD conversions, see the Timer 2 ISR
 volatile unsigned char T_DelayOff;           // Used by adc_hardware as to time delay before OFF message
 
 // Hardware initialisation and ISR routines
@@ -9,6 +9,7 @@
 // http://www.gnu.org/licenses/gpl.txt
 //
 // history:   2014-01-08 V0.1 Initial version
+//            2026-10-16 V0.2 The tracks are tested as masks of adc_on and adc_off
 //
 // Each GBM can support two speed measurment tracks. The time it took for a train to pass that
 // track is measured, and since the length of that track is also known, the train's speed can 
@@ -22,9 +23,11 @@
 // - write_lcd_string1() and write_lcd_string2 (lcd_ap) to display the results 
 //
 // Input data used:
-// Reads adc_result[8], which is maintained within adc_hardware,c
-// - is_on  == 1: Track is certainly occupied by train (spikes have already been filtered) 
-// - is_off == 1: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// Reads the masks adc_on and adc_off, which are maintained within adc_hardware,c (bit i is ADC pin i)
+// - adc_on:  Track is certainly occupied by train (spikes have already been filtered) 
+// - adc_off: Track is certainly free (we already waited a certain time to filter bad rail contacts) 
+// The tracks TA, TB, TC and TN are kept as masks, so each condition of the state tables below is
+// a single AND and compare on adc_on and adc_off
 //
 //************************************************************************************************
 
@@ -43,7 +46,7 @@
 #include "config.h"		// general definitions the decoder, cv's
 #include "myeeprom.h"           // wrapper for eeprom
 #include "hardware.h"		// port definitions for target
-#include "adc_hardware.h"       // for reading values from the struct array adc_result
+#include "adc_hardware.h"       // for reading the adc_on and adc_off masks
 #include "timer1.h"       	// for start_up_phase() and time_for_next_feedback() 
 #include "lcd_ap.h"		// to display the speed
 #include "speed.h"	 	// to measure the train's speed on one of the special tracks
@@ -73,13 +76,13 @@ struct
 {
   unsigned int  length;	// the length of this measurement track (in millimeters)
   unsigned char number;	// the ADC input port for this measurement track
-  unsigned char next;	// the ADC input port that should be triggered to complete the measurement
+  unsigned char next;	// the ADC input port that should be triggered to complete the measurement (mask)
   unsigned char status;	// if the measurement has already started, or if we're done or have errors
   unsigned int  time; 	// the time the train neede to pass this measurement track (in 40ms ticks)
 } tracks[2];		// we have two measurement tracks
 
 
-// The following variables are used to hold temporary data
+// The following variables are used to hold temporary data (masks of ADC input ports)
 unsigned char TA;	// Shortcut for tracks[i].number - 1 (ADC input port before)
 unsigned char TB;	// Shortcut for tracks[i].number     (ADC input port of measurement track)
 unsigned char TC;	// Shortcut for tracks[i].number + 1 (ADC input port after)
@@ -154,20 +157,22 @@ void clear_lcd_string(void) {
 // check speed for one of the tracks (i: 0..1)
 //************************************************************************************************
 void check_speed_track(unsigned char i) {
-  TA = tracks[i].number - 1;
-  TB = tracks[i].number;
-  TC = tracks[i].number + 1;
+  unsigned char on = adc_on;	// both masks of the same generation
+  unsigned char off = adc_off;
+  TB = 1 << tracks[i].number;
+  TA = TB >> 1;
+  TC = TB << 1;
   TN = tracks[i].next;
   // OPTION 1: The status is INACTIVE
   if (tracks[i].status == INACTIVE) {
     // check if train comes from left and we should become ACTIVE
-    if ((adc_result[TA].is_on) && (adc_result[TB].is_on) && (adc_result[TC].is_off)) {
+    if (((on & (TA | TB)) == (TA | TB)) && (off & TC)) {
       tracks[i].next = TC;
       tracks[i].status = ACTIVE;
       tracks[i].time = 0;
     }
     // check if train comes from right and we should become ACTIVE
-    if ((adc_result[TA].is_off) && (adc_result[TB].is_on) && (adc_result[TC].is_on)) {
+    if ((off & TA) && ((on & (TB | TC)) == (TB | TC))) {
       tracks[i].next = TA;
       tracks[i].status = ACTIVE;
       tracks[i].time = 0;
@@ -177,9 +182,9 @@ void check_speed_track(unsigned char i) {
   else if (tracks[i].status == ACTIVE) {
     tracks[i].time ++;
     // STEP 2A: Make sure that the measurement track is still occupied
-    if (adc_result[TB].is_off) {tracks[i].status = ERROR;}
+    if (off & TB) {tracks[i].status = ERROR;}
     // STEP 2B: Check if the next track has been reached
-    else if (adc_result[TN].is_on) {
+    else if (on & TN) {
       // yes, show the results
       tracks[i].status = SHOW;
       // calculate the speed. Use long long, which are 8 bytes
@@ -222,7 +227,7 @@ void check_speed_track(unsigned char i) {
   }
   // OPTION 4: The status is DONE or ERROR
   else if ((tracks[i].status == DONE) || (tracks[i].status == ERROR)) {
-    if ((adc_result[TA].is_off) && (adc_result[TB].is_off) && (adc_result[TC].is_off)) {
+    if ((off & (TA | TB | TC)) == (TA | TB | TC)) {
       tracks[i].status = INACTIVE;
       //write_lcd_string_line(i, "INACTIVE        ");
       clear_lcd_string();